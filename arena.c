@@ -19,186 +19,1634 @@
 */
 
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
 #include <pthread.h>
 #include "arena.h"
 
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/*
+    Adds n to a counter of arena->counters, see ArenaCounters. ARENA_LOCKFREE
+    arenas count with relaxed atomics, the others only count under the mutex.
+*/
+#define ARENA_COUNT(arena, field, n) \
+    do{ \
+        if((arena)->flags & ARENA_LOCKFREE){ \
+            __atomic_fetch_add(&(arena)->counters.field, (n), __ATOMIC_RELAXED); \
+        } else{ \
+            (arena)->counters.field += (n); \
+        } \
+    } while(0)
+
+/*
+    Adds n to a counter of counters, which arena_thread_counters returned.
+    A counter slot has a single writer, so no atomic read-modify-write is
+    needed, only untorn loads and stores for arena_stats.
+*/
+#define ARENA_COUNT_TO(arena, counters, field, n) \
+    do{ \
+        if((counters) != &(arena)->counters){ \
+            __atomic_store_n(&(counters)->field, \
+                             __atomic_load_n(&(counters)->field, __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED); \
+        } else{ \
+            ARENA_COUNT(arena, field, n); \
+        } \
+    } while(0)
+
+static const ArenaCounters arena_counters_zero;
+
+/*
+    Per-thread counter slots of ARENA_LOCKFREE arenas. On its first count a
+    thread claims a free bit of arena_slot_mask, and owns slot i of every
+    arena until it exits, so counting never touches a cache line that other
+    threads write. Bits are given back by the arena_slot_key destructor. A
+    thread that finds no free bit counts in arena->counters instead.
+*/
+#define ARENA_SLOT_STRIDE    ((sizeof(ArenaCounters) + ARENA_CACHE_LINE - 1) & ~(size_t)(ARENA_CACHE_LINE - 1))
+#define ARENA_SLOT(arena, i) ((ArenaCounters*)((unsigned char*)(arena)->slots + (size_t)(i) * ARENA_SLOT_STRIDE))
+
+static uint64_t arena_slot_mask;
+static pthread_key_t arena_slot_key;
+static pthread_once_t arena_slot_once = PTHREAD_ONCE_INIT;
+static __thread int arena_thread_slot; /* slot + 1, 0 before the first count, -1 when none was free */
+
+static void
+arena_slot_release(void *value)
+{
+    uint64_t bit = (uint64_t)1 << ((uintptr_t)value - 1);
+    __atomic_fetch_and(&arena_slot_mask, ~bit, __ATOMIC_RELEASE);
+}
+
+static void
+arena_slot_key_create(void)
+{
+    int ret;
+    ret = pthread_key_create(&arena_slot_key, arena_slot_release);
+    assert(ret == 0);
+}
+
+/* Claims a slot for the calling thread, -1 if all of them are taken */
+static int
+arena_slot_claim(void)
+{
+    uint64_t mask;
+    int slot;
+
+    pthread_once(&arena_slot_once, arena_slot_key_create);
+    mask = __atomic_load_n(&arena_slot_mask, __ATOMIC_RELAXED);
+    do{
+        if(~mask == 0){
+            return -1;
+        }
+        slot = __builtin_ctzll(~mask);
+    } while(!__atomic_compare_exchange_n(&arena_slot_mask, &mask, mask | (uint64_t)1 << slot, 1,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    pthread_setspecific(arena_slot_key, (void*)(uintptr_t)(slot + 1));
+    return slot;
+}
+
+/* Slot of the calling thread in arena, -1 when it counts in arena->counters */
+static int
+arena_thread_slot_index(Arena *arena)
+{
+    int slot;
+
+    if(arena->slots == NULL){
+        return -1;
+    }
+    if(arena_thread_slot == 0){
+        slot = arena_slot_claim();
+        arena_thread_slot = slot < 0 ? -1 : slot + 1;
+    }
+    return arena_thread_slot < 0 ? -1 : arena_thread_slot - 1;
+}
+
+/* Where the calling thread counts the allocations it makes from arena */
+static ArenaCounters*
+arena_thread_counters(Arena *arena)
+{
+    int slot = arena_thread_slot_index(arena);
+    return slot < 0 ? &arena->counters : ARENA_SLOT(arena, slot);
+}
+
+static int
+arena_histogram_bucket(size_t size)
+{
+    int b = 0;
+    while(size > 1 && b < ARENA_HISTOGRAM_BUCKETS - 1){
+        size >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* Counts one allocation of size bytes into counters, owned by the caller */
+static void
+arena_count_alloc(unsigned flags, ArenaCounters *counters, size_t size)
+{
+    counters->alloc_count++;
+    counters->alloc_bytes += size;
+    if(flags & ARENA_STATS_HISTOGRAM){
+        counters->histogram[arena_histogram_bucket(size)]++;
+    }
+}
+
+static void
+arena_count_shared_alloc(Arena *arena, size_t size)
+{
+    ArenaCounters *counters = arena_thread_counters(arena);
+
+    ARENA_COUNT_TO(arena, counters, alloc_count, 1);
+    ARENA_COUNT_TO(arena, counters, alloc_bytes, size);
+    if(arena->flags & ARENA_STATS_HISTOGRAM){
+        ARENA_COUNT_TO(arena, counters, histogram[arena_histogram_bucket(size)], 1);
+    }
+}
+
+static void
+arena_count_realloc(Arena *arena, size_t old_size, int in_place)
+{
+    ArenaCounters *counters = arena_thread_counters(arena);
+
+    ARENA_COUNT_TO(arena, counters, realloc_count, 1);
+    if(in_place){
+        ARENA_COUNT_TO(arena, counters, realloc_in_place, 1);
+    } else{
+        ARENA_COUNT_TO(arena, counters, orphaned_bytes, old_size);
+    }
+}
+
+/* Profiler hooks, see ARENA_PROFILE. locked tells whether the caller holds the mutex */
+#ifdef ARENA_PROFILE
+static void arena_profile_record(Arena *arena, const char *tag, size_t bytes, int locked);
+static void arena_profile_init(Arena *arena);
+static void arena_profile_free(Arena *arena);
+#define ARENA_PROFILE_RECORD(arena, tag, bytes, locked) arena_profile_record(arena, tag, bytes, locked)
+#define ARENA_PROFILE_INIT(arena) arena_profile_init(arena)
+#define ARENA_PROFILE_FREE(arena) arena_profile_free(arena)
+#else
+#define ARENA_PROFILE_RECORD(arena, tag, bytes, locked) ((void)(tag))
+#define ARENA_PROFILE_INIT(arena) ((void)0)
+#define ARENA_PROFILE_FREE(arena) ((void)0)
+#endif
+
+static void
+arena_lock(Arena *arena)
+{
+    int ret;
+
+    ret = pthread_mutex_trylock(&arena->mutex);
+    if(ret == 0){
+        return;
+    }
+    ret = pthread_mutex_lock(&arena->mutex);
+    assert(ret == 0);
+    ARENA_COUNT(arena, lock_contended, 1);
+}
+
+static void
+arena_unlock(Arena *arena)
+{
+    int ret;
+    ret = pthread_mutex_unlock(&arena->mutex);
+    assert(ret == 0);
+}
+
+/* Touches every page so later accesses do not fault */
+static void
+arena_prefault(unsigned char *ptr, size_t size)
+{
+    size_t i, page_size = sysconf(_SC_PAGESIZE);
+    for(i = 0; i < size; i += page_size){
+        ((volatile unsigned char*)ptr)[i] = 0;
+    }
+}
+
+/*
+    Maps size bytes of anonymous memory with the page options of flags:
+      - ARENA_HUGETLB tries MAP_HUGETLB first and falls back to ARENA_HUGEPAGE
+        when no huge pages are reserved;
+      - ARENA_HUGEPAGE maps 2 MB aligned memory and asks for transparent huge
+        pages with madvise;
+      - ARENA_POPULATE prefaults everything with MAP_POPULATE.
+    size must be a multiple of ARENA_HUGE_PAGE_SIZE for the huge page options.
+*/
+static void*
+arena_map(size_t size, int prot, int map_flags, unsigned flags)
+{
+    unsigned char *ptr;
+    size_t head;
+
+    if(flags & ARENA_POPULATE){
+        map_flags |= MAP_POPULATE;
+    }
+
+#ifdef MAP_HUGETLB
+    if(flags & ARENA_HUGETLB){
+        ptr = mmap(NULL, size, prot, map_flags | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED){
+            return ptr;
+        }
+        flags |= ARENA_HUGEPAGE;
+    }
+#endif
+
+    if(!(flags & ARENA_HUGEPAGE)){
+        ptr = mmap(NULL, size, prot, map_flags, -1, 0);
+        assert(ptr != MAP_FAILED);
+        return ptr;
+    }
+
+    /* Over-map, then trim both ends so the mapping starts on a huge page boundary */
+    ptr = mmap(NULL, size + ARENA_HUGE_PAGE_SIZE, prot, map_flags & ~MAP_POPULATE, -1, 0);
+    assert(ptr != MAP_FAILED);
+    head = (size_t)(-(uintptr_t)ptr) & (ARENA_HUGE_PAGE_SIZE - 1);
+    if(head != 0){
+        munmap(ptr, head);
+    }
+    munmap(ptr + head + size, ARENA_HUGE_PAGE_SIZE - head);
+    ptr += head;
+
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    if((flags & ARENA_POPULATE) && (prot & PROT_WRITE)){
+        arena_prefault(ptr, size);
+    }
+    return ptr;
+}
+
+/* Region sizes are rounded up to whole huge pages when huge pages are in use */
+static size_t
+arena_region_map_size(Arena *arena, size_t size)
+{
+    if(arena->flags & (ARENA_HUGEPAGE | ARENA_HUGETLB)){
+        size = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~(ARENA_HUGE_PAGE_SIZE - 1);
+    }
+    return size;
+}
+
+/*
+    Process-wide cache of released regions, shared by every arena. Only plain
+    regions (no huge pages, not ARENA_VIRTUAL) are cached. Regions keep the
+    size they were mapped with; bucket b holds mappings of
+    [ARENA_CACHE_MIN_SIZE << b, ARENA_CACHE_MIN_SIZE << (b + 1)) bytes, and a
+    lookup takes the first region of its bucket that is big enough.
+*/
+static struct {
+    pthread_mutex_t mutex;
+    Region *buckets[ARENA_CACHE_BUCKETS];
+    size_t counts[ARENA_CACHE_BUCKETS];
+    size_t bytes;
+    size_t max_bytes;
+    size_t max_per_bucket;
+} arena_cache = {
+    PTHREAD_MUTEX_INITIALIZER, {0}, {0}, 0,
+    ARENA_CACHE_DEFAULT_MAX_BYTES, ARENA_CACHE_DEFAULT_MAX_PER_BUCKET
+};
+
+/* Bucket of a mapping of size bytes, or -1 if it is not a cacheable size */
+static int
+arena_cache_bucket(size_t size)
+{
+    int b;
+
+    if(size < ARENA_CACHE_MIN_SIZE || size > ARENA_CACHE_MAX_SIZE){
+        return -1;
+    }
+    for(b = 0; size >= ARENA_CACHE_MIN_SIZE << (b + 1); ++b);
+    return b;
+}
+
+/* A cached region mapped with at least size bytes, or NULL */
+static Region*
+arena_cache_get(size_t size)
+{
+    Region *region, **link;
+    size_t region_size;
+    int b, ret;
+
+    b = arena_cache_bucket(size);
+    if(b < 0 || __atomic_load_n(&arena_cache.counts[b], __ATOMIC_RELAXED) == 0){
+        return NULL;
+    }
+
+    ret = pthread_mutex_lock(&arena_cache.mutex);
+    assert(ret == 0);
+    for(link = &arena_cache.buckets[b]; (region = *link) != NULL; link = &region->next){
+        region_size = ARENA_REGION_SIZE + region->capacity;
+        if(region_size >= size){
+            *link = region->next;
+            __atomic_store_n(&arena_cache.counts[b], arena_cache.counts[b] - 1, __ATOMIC_RELAXED);
+            arena_cache.bytes -= region_size;
+            break;
+        }
+    }
+    ret = pthread_mutex_unlock(&arena_cache.mutex);
+    assert(ret == 0);
+
+    return region;
+}
+
+/* Returns 1 if the cache took the region */
+static int
+arena_cache_put(Region *region)
+{
+    size_t size;
+    int b, ret, taken = 0;
+
+    if(region->flags != 0){
+        return 0;
+    }
+    size = ARENA_REGION_SIZE + region->capacity;
+    b = arena_cache_bucket(size);
+    if(b < 0){
+        return 0;
+    }
+
+    ret = pthread_mutex_lock(&arena_cache.mutex);
+    assert(ret == 0);
+    if(arena_cache.counts[b] < arena_cache.max_per_bucket &&
+       arena_cache.bytes + size <= arena_cache.max_bytes){
+        region->next = arena_cache.buckets[b];
+        arena_cache.buckets[b] = region;
+        __atomic_store_n(&arena_cache.counts[b], arena_cache.counts[b] + 1, __ATOMIC_RELAXED);
+        arena_cache.bytes += size;
+        taken = 1;
+    }
+    ret = pthread_mutex_unlock(&arena_cache.mutex);
+    assert(ret == 0);
+
+    return taken;
+}
+
 static Region*
-arena_new_region(size_t size)
+arena_new_region(Arena *arena, size_t size)
 {
     Region *region;
     void *ptr;
+    unsigned flags;
 
-    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    assert(ptr != MAP_FAILED);
+    flags = arena->flags & (ARENA_HUGEPAGE | ARENA_HUGETLB);
+    if(flags == 0){
+        region = arena_cache_get(size);
+        if(region != NULL){
+            region->next  = NULL;
+            region->count = 0;
+            ARENA_COUNT(arena, cache_hits, 1);
+            return region;
+        }
+    }
+
+    size = arena_region_map_size(arena, size);
+    ptr = arena_map(size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, arena->flags);
+    ARENA_COUNT(arena, mmap_calls, 1);
 
     region             = (Region*) ptr;
     region->next       = NULL;
     region->capacity   = size - ARENA_REGION_SIZE;
-    region->remaining  = size - ARENA_REGION_SIZE;
+    region->committed  = region->capacity;
     region->count      = 0;
+    region->flags      = flags;
     region->bytes      = ((unsigned char*)ptr) + ARENA_REGION_SIZE;
 
-    return region;
+    return region;
+}
+
+/*
+    ARENA_VIRTUAL region: reserve bytes of address space with no access and
+    only commit the first commit bytes. The rest is committed by
+    arena_region_commit as the bump pointer advances, so the region grows
+    in place and its memory stays contiguous. MAP_HUGETLB cannot be committed
+    piecemeal, so ARENA_HUGETLB is treated as ARENA_HUGEPAGE here.
+*/
+static Region*
+arena_new_virtual_region(Arena *arena, size_t reserve, size_t commit)
+{
+    Region *region;
+    unsigned char *ptr;
+    unsigned flags;
+    int ret;
+
+    assert(commit <= reserve);
+    flags = arena->flags & (ARENA_HUGEPAGE | ARENA_HUGETLB) ? ARENA_HUGEPAGE : 0;
+    reserve = arena_region_map_size(arena, reserve);
+    ptr = arena_map(reserve, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, flags);
+    ARENA_COUNT(arena, mmap_calls, 1);
+    ret = mprotect(ptr, commit, PROT_READ | PROT_WRITE);
+    assert(ret == 0);
+    if(arena->flags & ARENA_POPULATE){
+        arena_prefault(ptr, commit);
+    }
+
+    region             = (Region*) ptr;
+    region->next       = NULL;
+    region->capacity   = reserve - ARENA_REGION_SIZE;
+    region->committed  = commit - ARENA_REGION_SIZE;
+    region->count      = 0;
+    region->flags      = ARENA_VIRTUAL | flags;
+    region->bytes      = ptr + ARENA_REGION_SIZE;
+
+    return region;
+}
+
+static void
+arena_unmap_region(Region* region)
+{
+    assert(region != NULL);
+    size_t size_bytes = ARENA_REGION_SIZE + region->capacity;
+    int ret = munmap(region, size_bytes);
+    assert(ret == 0);
+}
+
+static void
+arena_free_region(Arena *arena, Region* region)
+{
+    assert(region != NULL);
+    if(!arena_cache_put(region)){
+        arena_unmap_region(region);
+        ARENA_COUNT(arena, munmap_calls, 1);
+    }
+}
+
+/* Unmaps cached regions until the cache fits in max_bytes and max_per_bucket */
+static void
+arena_cache_trim(size_t max_bytes, size_t max_per_bucket)
+{
+    Region *region, *release = NULL;
+    int b, ret;
+
+    ret = pthread_mutex_lock(&arena_cache.mutex);
+    assert(ret == 0);
+    for(b = ARENA_CACHE_BUCKETS - 1; b >= 0; --b){
+        while(arena_cache.buckets[b] != NULL &&
+              (arena_cache.counts[b] > max_per_bucket || arena_cache.bytes > max_bytes)){
+            region = arena_cache.buckets[b];
+            arena_cache.buckets[b] = region->next;
+            __atomic_store_n(&arena_cache.counts[b], arena_cache.counts[b] - 1, __ATOMIC_RELAXED);
+            arena_cache.bytes -= ARENA_REGION_SIZE + region->capacity;
+            region->next = release;
+            release = region;
+        }
+    }
+    ret = pthread_mutex_unlock(&arena_cache.mutex);
+    assert(ret == 0);
+
+    /* munmap outside the lock */
+    while(release != NULL){
+        region = release;
+        release = release->next;
+        arena_unmap_region(region);
+    }
+}
+
+void
+arena_cache_config(size_t max_bytes, size_t max_per_bucket)
+{
+    int ret;
+
+    ret = pthread_mutex_lock(&arena_cache.mutex);
+    assert(ret == 0);
+    __atomic_store_n(&arena_cache.max_bytes, max_bytes, __ATOMIC_RELAXED);
+    arena_cache.max_per_bucket = max_per_bucket;
+    ret = pthread_mutex_unlock(&arena_cache.mutex);
+    assert(ret == 0);
+
+    /* Regions over the new limits are released right away */
+    arena_cache_trim(max_bytes, max_per_bucket);
+}
+
+void
+arena_cache_drain(void)
+{
+    arena_cache_trim(0, 0);
+}
+
+static size_t
+arena_align_size(size_t size)
+{
+    size_t size_page_aligned, page_size, region_size, size_bytes;
+    region_size = ARENA_REGION_SIZE;
+    page_size = sysconf(_SC_PAGESIZE);
+    size_bytes = region_size + size;
+    size_page_aligned = (size_bytes + page_size - 1) & ~(page_size - 1);
+    return size_page_aligned;
+}
+
+/* Bytes needed to move ptr up to the next multiple of align */
+static size_t
+arena_align_padding(const unsigned char *ptr, size_t align)
+{
+    return (size_t)(-(uintptr_t)ptr) & (align - 1);
+}
+
+/*
+    Makes the first end bytes of the region's payload accessible. Returns 0 if
+    end is past the reservation. Commits at least ARENA_COMMIT_SIZE at a time.
+    Must be called with the mutex held.
+*/
+static int
+arena_region_commit(Arena *arena, Region *region, size_t end)
+{
+    size_t committed, target, granularity;
+    int ret;
+
+    committed = region->committed;
+    if(end <= committed){
+        return 1;
+    }
+    if(end > region->capacity){
+        return 0;
+    }
+
+    /*
+        Commit boundaries are kept on granularity boundaries of the mapping
+        (the header shares the first page), so that with huge pages every
+        committed 2 MB range can be backed by one huge page.
+    */
+    granularity = arena->flags & (ARENA_HUGEPAGE | ARENA_HUGETLB) ?
+                  ARENA_HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    target = end - committed;
+    if(target < (size_t)ARENA_COMMIT_SIZE){
+        target = ARENA_COMMIT_SIZE;
+    }
+    target = ARENA_REGION_SIZE + committed + target;
+    target = ((target + granularity - 1) & ~(granularity - 1)) - ARENA_REGION_SIZE;
+    if(target > region->capacity){
+        target = region->capacity;
+    }
+
+    /* The file mapping covers the whole reservation, pages past the end of the file are what is uncommitted */
+    if(region->flags & ARENA_FILE){
+        if(ftruncate(arena->file, ARENA_FILE_HEADER_SIZE + ARENA_REGION_SIZE + target) != 0){
+            return 0;
+        }
+    } else{
+        ret = mprotect(region->bytes + committed, target - committed, PROT_READ | PROT_WRITE);
+        assert(ret == 0);
+    }
+    if(arena->flags & ARENA_POPULATE){
+        arena_prefault(region->bytes + committed, target - committed);
+    }
+
+    __atomic_store_n(&region->committed, target, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+    Hands out size bytes aligned to align from region, or NULL if they do not
+    fit in its committed memory.
+    In ARENA_LOCKFREE mode every bump is a CAS on region->count, since threads
+    on the lock-free fast path may race on the same region.
+*/
+static void*
+arena_region_bump(Arena *arena, Region *region, size_t size, size_t align)
+{
+    size_t count, pad, committed;
+
+    if(!(arena->flags & ARENA_LOCKFREE)){
+        count = region->count;
+        pad = arena_align_padding(region->bytes + count, align);
+        if(pad + size > region->committed - count){
+            return NULL;
+        }
+        region->count = count + pad + size;
+        return (void*)(region->bytes + count + pad);
+    }
+
+    committed = __atomic_load_n(&region->committed, __ATOMIC_ACQUIRE);
+    count = __atomic_load_n(&region->count, __ATOMIC_RELAXED);
+    do{
+        pad = arena_align_padding(region->bytes + count, align);
+        if(count > committed || pad + size > committed - count){
+            return NULL;
+        }
+    } while(!__atomic_compare_exchange_n(&region->count, &count, count + pad + size, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return (void*)(region->bytes + count + pad);
+}
+
+/*
+    Creates a region of at least min_size bytes that fits size bytes aligned
+    to align, with the block already handed out (it ends at the region's bump
+    pointer). The region is fully set up before arena_link_region makes it
+    reachable, so lock-free readers never see a half-built region.
+*/
+static Region*
+arena_new_block_region(Arena *arena, size_t size, size_t align, size_t min_size)
+{
+    Region *region;
+    size_t region_size, pad;
+
+    /* Payloads are cache-line aligned, only bigger alignments need slack */
+    region_size = arena_align_size(size + (align > ARENA_CACHE_LINE ? align - 1 : 0));
+    if(region_size < min_size){
+        region_size = min_size;
+    }
+    region = arena_new_region(arena, region_size);
+    pad = arena_align_padding(region->bytes, align);
+    region->count = pad + size;
+    return region;
+}
+
+/* Links region right after prev, or at the head when prev is NULL. Must be called with the mutex held */
+static void
+arena_link_region(Arena *arena, Region *prev, Region *region)
+{
+    if(prev == NULL){
+        region->next = arena->head;
+        arena->head = region;
+    } else{
+        region->next = prev->next;
+        prev->next = region;
+    }
+    if(arena->tail == prev){
+        arena->tail = region;
+    }
+}
+
+/* The header page in front of the only region of an ARENA_FILE arena */
+#define ARENA_FILE_HEADER(arena) ((ArenaFileHeader*)((unsigned char*)(arena)->head - ARENA_FILE_HEADER_SIZE))
+
+/* Start of the most recent block of a region returned by arena_new_block_region */
+#define ARENA_REGION_LAST_BLOCK(region, size) ((void*)((region)->bytes + (region)->count - (size)))
+
+static void arena_init_region(Arena *arena, Region *region, ArenaOpts opts);
+
+/* This must be called at the beginning of the lifetime to initialize the arena*/
+void
+_arena_init(Arena *arena, size_t size, ArenaOpts opts)
+{
+    Region *region;
+
+    /* Set before the first region, which is already counted */
+    arena->flags = opts.flags;
+    arena->counters = arena_counters_zero;
+    size = arena_align_size(size);
+    if(opts.flags & ARENA_VIRTUAL){
+        if(opts.reserve == 0){
+            opts.reserve = ARENA_VIRTUAL_DEFAULT_RESERVE;
+        }
+        opts.reserve = arena_region_map_size(arena, arena_align_size(opts.reserve));
+        size = arena_region_map_size(arena, size);
+        region = arena_new_virtual_region(arena, opts.reserve, size < opts.reserve ? size : opts.reserve);
+    } else{
+        region = arena_new_region(arena, size);
+    }
+    arena_init_region(arena, region, opts);
+}
+
+/* Everything but the flags and counters of a new arena whose only region is region */
+static void
+arena_init_region(Arena *arena, Region *region, ArenaOpts opts)
+{
+    int ret;
+
+    arena->head = region;
+    arena->tail = region;
+    arena->curr = region;
+    arena->prev = NULL;
+    arena->retain = opts.retain;
+    arena->high_water = 0;
+    arena->generation = 0;
+    arena->slots = NULL;
+    if(arena->flags & ARENA_LOCKFREE){
+        arena->slots = mmap(NULL, ARENA_COUNTER_SLOTS * ARENA_SLOT_STRIDE, PROT_READ | PROT_WRITE,
+                            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        assert(arena->slots != MAP_FAILED);
+    }
+    arena->file = -1;
+    ARENA_PROFILE_INIT(arena);
+
+    /* Init the mutex */
+    ret = pthread_mutex_init(&arena->mutex, NULL);
+    assert(ret == 0);
+}
+
+/*
+    Region selection, O(1):
+      - everything is bumped from arena->curr; regions before it are retired
+        and regions after it are fresh (emptied by arena_reset/arena_rewind);
+      - a request that does not fit moves the cursor to the next region if it
+        fits there;
+      - otherwise a large request, while curr still has plenty of room, gets a
+        dedicated region linked just before curr, so nothing is retired;
+      - otherwise curr is nearly full: retire it and move the cursor to a new
+        region linked right after it.
+    Keeping fresh regions strictly after the cursor is what lets arena_rewind
+    find everything allocated since a mark. Huge page regions are at least
+    2 MB, so "large" scales with them, or every mid-size request would map one.
+    A new region is fully built, and its block taken, before it is linked:
+    lock-free threads may bump it as soon as it is reachable.
+*/
+static void*
+arena_alloc_unlocked(Arena *arena, size_t size, size_t align)
+{
+    Region *curr, *next;
+    size_t count, large;
+    void *ptr;
+
+    assert(arena != NULL);
+    assert(arena->curr != NULL);
+
+    curr = arena->curr;
+    ptr = arena_region_bump(arena, curr, size, align);
+    if(ptr != NULL){
+        return ptr;
+    }
+
+    /* ARENA_VIRTUAL: commit more of the reservation and grow in place */
+    while(curr->committed < curr->capacity){
+        count = __atomic_load_n(&curr->count, __ATOMIC_RELAXED);
+        if(!arena_region_commit(arena, curr, count + arena_align_padding(curr->bytes + count, align) + size)){
+            break;
+        }
+        ptr = arena_region_bump(arena, curr, size, align);
+        if(ptr != NULL){
+            return ptr;
+        }
+    }
+
+    /* Anything outside the file would not persist */
+    if(curr->flags & ARENA_FILE){
+        return NULL;
+    }
+
+    next = curr->next;
+    if(next != NULL && (ptr = arena_region_bump(arena, next, size, align)) != NULL){
+        arena->prev = curr;
+        __atomic_store_n(&arena->curr, next, __ATOMIC_RELEASE);
+        return ptr;
+    }
+
+    large = arena->flags & (ARENA_HUGEPAGE | ARENA_HUGETLB) ?
+            ARENA_HUGE_PAGE_SIZE / 4 : (size_t)ARENA_LARGE_ALLOC_SIZE;
+    if(size > large && curr->capacity - __atomic_load_n(&curr->count, __ATOMIC_RELAXED) > large){
+        next = arena_new_block_region(arena, size, align, 0);
+        ptr = ARENA_REGION_LAST_BLOCK(next, size);
+        arena_link_region(arena, arena->prev, next);
+        arena->prev = next;
+        return ptr;
+    }
+
+    // Allocate new region as no space available
+    next = arena_new_block_region(arena, size, align, ARENA_REGION_DEFAULT_CAPACITY);
+    ptr = ARENA_REGION_LAST_BLOCK(next, size);
+    arena_link_region(arena, curr, next);
+    arena->prev = curr;
+    __atomic_store_n(&arena->curr, next, __ATOMIC_RELEASE);
+
+    return ptr;
+}
+
+
+/* counted is 0 for blocks the counters see some other way, tag is the profiler's or NULL */
+static void*
+arena_alloc_internal(Arena *arena, size_t size, size_t align, int counted, const char *tag)
+{
+    void *ptr;
+
+    assert(arena != NULL);
+    assert(arena->head != NULL);
+    assert(align != 0 && (align & (align - 1)) == 0);
+
+    /* Fast path: bump the current region without touching the mutex */
+    if(arena->flags & ARENA_LOCKFREE){
+        ptr = arena_region_bump(arena, __atomic_load_n(&arena->curr, __ATOMIC_ACQUIRE), size, align);
+        if(ptr != NULL){
+            if(counted){
+                arena_count_shared_alloc(arena, size);
+            }
+            ARENA_PROFILE_RECORD(arena, tag, size, 0);
+            return ptr;
+        }
+    }
+
+    arena_lock(arena);
+    ptr = arena_alloc_unlocked(arena, size, align);
+    if(counted){
+        arena_count_shared_alloc(arena, size);
+    }
+    ARENA_PROFILE_RECORD(arena, tag, size, 1);
+    arena_unlock(arena);
+
+    return ptr;
+}
+
+void*
+arena_alloc_aligned(Arena *arena, size_t size, size_t align)
+{
+    return arena_alloc_internal(arena, size, align, 1, NULL);
+}
+
+void*
+arena_alloc(Arena *arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT);
+}
+
+/*
+    Copy and length kernels. Every level handles unaligned heads and tails
+    itself; arena_simd_select picks one with CPUID, the first call to
+    arena_memcpy/arena_strlen selects ARENA_SIMD_AUTO. The strlen kernels
+    read whole aligned words/vectors, which never cross into the next page
+    but may cover bytes past the terminator, so ASan is kept out of them.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ARENA_X86
+#endif
+
+#define ARENA_NO_ASAN __attribute__((no_sanitize_address))
+
+/* Word loads of byte buffers, may_alias keeps them legal under strict aliasing */
+typedef size_t __attribute__((may_alias)) ArenaWord;
+
+typedef void *(*ArenaMemcpyFn)(void *dest, const void *src, size_t n);
+typedef size_t (*ArenaStrlenFn)(const char *str);
+
+static ArenaMemcpyFn arena_memcpy_fn;
+static ArenaStrlenFn arena_strlen_fn;
+static int arena_simd_current;
+
+#define ARENA_WORD_ONES  ((size_t)-1 / 0xFF)
+#define ARENA_WORD_HIGHS (ARENA_WORD_ONES * 0x80)
+#define ARENA_WORD_HAS_ZERO(w) (((w) - ARENA_WORD_ONES) & ~(w) & ARENA_WORD_HIGHS)
+
+/* Returns d + n like the kernels below, n <= 2 * sizeof(size_t) */
+static unsigned char*
+arena_memcpy_small(unsigned char *d, const unsigned char *s, size_t n)
+{
+    uint32_t a32, b32;
+    size_t aw, bw;
+
+    if(n >= sizeof(size_t)){
+        __builtin_memcpy(&aw, s, sizeof(size_t));
+        __builtin_memcpy(&bw, s + n - sizeof(size_t), sizeof(size_t));
+        __builtin_memcpy(d, &aw, sizeof(size_t));
+        __builtin_memcpy(d + n - sizeof(size_t), &bw, sizeof(size_t));
+    } else if(n >= 4){
+        __builtin_memcpy(&a32, s, 4);
+        __builtin_memcpy(&b32, s + n - 4, 4);
+        __builtin_memcpy(d, &a32, 4);
+        __builtin_memcpy(d + n - 4, &b32, 4);
+    } else{
+        for(; n != 0; n--){
+            *d++ = *s++;
+        }
+        return d;
+    }
+    return d + n;
+}
+
+static void*
+arena_memcpy_word(void *dest, const void *src, size_t n)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    size_t w0, w1;
+
+    if(n < 2 * sizeof(size_t)){
+        return arena_memcpy_small(d, s, n);
+    }
+    for(; n >= 2 * sizeof(size_t); n -= 2 * sizeof(size_t)){
+        __builtin_memcpy(&w0, s, sizeof(size_t));
+        __builtin_memcpy(&w1, s + sizeof(size_t), sizeof(size_t));
+        __builtin_memcpy(d, &w0, sizeof(size_t));
+        __builtin_memcpy(d + sizeof(size_t), &w1, sizeof(size_t));
+        d += 2 * sizeof(size_t);
+        s += 2 * sizeof(size_t);
+    }
+    /* Tail: the last 2 words again, overlapping what was already copied */
+    if(n != 0){
+        arena_memcpy_small(d + n - 2 * sizeof(size_t), s + n - 2 * sizeof(size_t), 2 * sizeof(size_t));
+    }
+    return d + n;
+}
+
+ARENA_NO_ASAN static size_t
+arena_strlen_word(const char *str)
+{
+    const unsigned char *p = (const unsigned char*)str;
+    size_t w;
+
+    for(; ((uintptr_t)p & (sizeof(size_t) - 1)) != 0; p++){
+        if(*p == '\0'){
+            return (const char*)p - str;
+        }
+    }
+    for(;; p += sizeof(size_t)){
+        w = *(const ArenaWord*)p;
+        if(ARENA_WORD_HAS_ZERO(w)){
+            break;
+        }
+    }
+    for(; *p != '\0'; p++);
+    return (const char*)p - str;
+}
+
+#ifdef ARENA_X86
+__attribute__((target("sse2"))) static void*
+arena_memcpy_sse2(void *dest, const void *src, size_t n)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    __m128i a, b, c, e;
+    size_t i;
+
+    if(n < 16){
+        return arena_memcpy_small(d, s, n);
+    }
+    /* Unaligned head, then stores aligned to the destination */
+    _mm_storeu_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+    i = 16 - ((uintptr_t)d & 15);
+    for(; i + 64 <= n; i += 64){
+        a = _mm_loadu_si128((const __m128i*)(s + i));
+        b = _mm_loadu_si128((const __m128i*)(s + i + 16));
+        c = _mm_loadu_si128((const __m128i*)(s + i + 32));
+        e = _mm_loadu_si128((const __m128i*)(s + i + 48));
+        _mm_store_si128((__m128i*)(d + i), a);
+        _mm_store_si128((__m128i*)(d + i + 16), b);
+        _mm_store_si128((__m128i*)(d + i + 32), c);
+        _mm_store_si128((__m128i*)(d + i + 48), e);
+    }
+    for(; i + 16 <= n; i += 16){
+        _mm_store_si128((__m128i*)(d + i), _mm_loadu_si128((const __m128i*)(s + i)));
+    }
+    if(i < n){
+        _mm_storeu_si128((__m128i*)(d + n - 16), _mm_loadu_si128((const __m128i*)(s + n - 16)));
+    }
+    return d + n;
+}
+
+ARENA_NO_ASAN __attribute__((target("sse2"))) static size_t
+arena_strlen_sse2(const char *str)
+{
+    const char *p = (const char*)((uintptr_t)str & ~(uintptr_t)15);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a, b;
+    unsigned mask;
+
+    /* The first aligned block may start before str, drop those bytes */
+    mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)p), zero));
+    mask >>= str - p;
+    if(mask != 0){
+        return __builtin_ctz(mask);
+    }
+    p += 16;
+    if(((uintptr_t)p & 16) != 0){
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)p), zero));
+        if(mask != 0){
+            return p + __builtin_ctz(mask) - str;
+        }
+        p += 16;
+    }
+    for(;; p += 32){
+        a = _mm_load_si128((const __m128i*)p);
+        b = _mm_load_si128((const __m128i*)(p + 16));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(a, b), zero)) != 0){
+            break;
+        }
+    }
+    mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero));
+    if(mask != 0){
+        return p + __builtin_ctz(mask) - str;
+    }
+    mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b, zero));
+    return p + 16 + __builtin_ctz(mask) - str;
+}
+
+__attribute__((target("avx2"))) static void*
+arena_memcpy_avx2(void *dest, const void *src, size_t n)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    __m256i a, b, c, e;
+    size_t i;
+
+    if(n < 32){
+        return arena_memcpy_sse2(d, s, n);
+    }
+    /* Unaligned head, then stores aligned to the destination */
+    _mm256_storeu_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+    i = 32 - ((uintptr_t)d & 31);
+    for(; i + 128 <= n; i += 128){
+        a = _mm256_loadu_si256((const __m256i*)(s + i));
+        b = _mm256_loadu_si256((const __m256i*)(s + i + 32));
+        c = _mm256_loadu_si256((const __m256i*)(s + i + 64));
+        e = _mm256_loadu_si256((const __m256i*)(s + i + 96));
+        _mm256_store_si256((__m256i*)(d + i), a);
+        _mm256_store_si256((__m256i*)(d + i + 32), b);
+        _mm256_store_si256((__m256i*)(d + i + 64), c);
+        _mm256_store_si256((__m256i*)(d + i + 96), e);
+    }
+    for(; i + 32 <= n; i += 32){
+        _mm256_store_si256((__m256i*)(d + i), _mm256_loadu_si256((const __m256i*)(s + i)));
+    }
+    if(i < n){
+        _mm256_storeu_si256((__m256i*)(d + n - 32), _mm256_loadu_si256((const __m256i*)(s + n - 32)));
+    }
+    return d + n;
+}
+
+ARENA_NO_ASAN __attribute__((target("avx2"))) static size_t
+arena_strlen_avx2(const char *str)
+{
+    const char *p = (const char*)((uintptr_t)str & ~(uintptr_t)31);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i a, b;
+    unsigned mask;
+
+    mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)p), zero));
+    mask >>= str - p;
+    if(mask != 0){
+        return __builtin_ctz(mask);
+    }
+    p += 32;
+    if(((uintptr_t)p & 32) != 0){
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)p), zero));
+        if(mask != 0){
+            return p + __builtin_ctz(mask) - str;
+        }
+        p += 32;
+    }
+    /* 64 bytes per step, one page never splits them: a zero byte makes the min zero */
+    for(;; p += 64){
+        a = _mm256_load_si256((const __m256i*)p);
+        b = _mm256_load_si256((const __m256i*)(p + 32));
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(a, b), zero)) != 0){
+            break;
+        }
+    }
+    mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, zero));
+    if(mask != 0){
+        return p + __builtin_ctz(mask) - str;
+    }
+    mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, zero));
+    return p + 32 + __builtin_ctz(mask) - str;
+}
+#endif /* ARENA_X86 */
+
+int
+arena_simd_select(int level)
+{
+    int best = ARENA_SIMD_WORD;
+    ArenaMemcpyFn copy = arena_memcpy_word;
+    ArenaStrlenFn len = arena_strlen_word;
+
+#ifdef ARENA_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")){
+        best = ARENA_SIMD_SSE2;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        best = ARENA_SIMD_AVX2;
+    }
+#endif
+    if(level == ARENA_SIMD_AUTO || level > best){
+        level = best;
+    }
+
+#ifdef ARENA_X86
+    if(level == ARENA_SIMD_SSE2){
+        copy = arena_memcpy_sse2;
+        len = arena_strlen_sse2;
+    } else if(level == ARENA_SIMD_AVX2){
+        copy = arena_memcpy_avx2;
+        len = arena_strlen_avx2;
+    }
+#endif
+    __atomic_store_n(&arena_memcpy_fn, copy, __ATOMIC_RELAXED);
+    __atomic_store_n(&arena_strlen_fn, len, __ATOMIC_RELAXED);
+    __atomic_store_n(&arena_simd_current, level, __ATOMIC_RELAXED);
+    return level;
+}
+
+int
+arena_simd_level(void)
+{
+    int level = __atomic_load_n(&arena_simd_current, __ATOMIC_RELAXED);
+    return level != ARENA_SIMD_AUTO ? level : arena_simd_select(ARENA_SIMD_AUTO);
+}
+
+size_t
+arena_strlen(const char *str)
+{
+    ArenaStrlenFn fn = __atomic_load_n(&arena_strlen_fn, __ATOMIC_RELAXED);
+    if(fn == NULL){
+        arena_simd_select(ARENA_SIMD_AUTO);
+        fn = __atomic_load_n(&arena_strlen_fn, __ATOMIC_RELAXED);
+    }
+    return fn(str);
+}
+
+void *
+arena_memcpy(void *dest, const void *src, size_t n)
+{
+    ArenaMemcpyFn fn = __atomic_load_n(&arena_memcpy_fn, __ATOMIC_RELAXED);
+    if(fn == NULL){
+        arena_simd_select(ARENA_SIMD_AUTO);
+        fn = __atomic_load_n(&arena_memcpy_fn, __ATOMIC_RELAXED);
+    }
+    return fn(dest, src, n);
+}
+
+/*
+    Grows the block ending at end by extra bytes if it is the last allocation
+    of region and the region has room. With can_commit set (mutex held) it may
+    also commit more of an ARENA_VIRTUAL reservation. Returns 1 on success.
+*/
+static int
+arena_region_extend(Arena *arena, Region *region, unsigned char *end, size_t extra, int can_commit)
+{
+    size_t count;
+
+    if(end < region->bytes || end > region->bytes + region->capacity){
+        return 0;
+    }
+    count = (size_t)(end - region->bytes);
+    if(extra > region->capacity - count){
+        return 0;
+    }
+    if(count != __atomic_load_n(&region->count, __ATOMIC_RELAXED)){
+        return 0;
+    }
+    if(can_commit && !arena_region_commit(arena, region, count + extra)){
+        return 0;
+    }
+    if(extra > __atomic_load_n(&region->committed, __ATOMIC_ACQUIRE) - count){
+        return 0;
+    }
+
+    if(arena->flags & ARENA_LOCKFREE){
+        return __atomic_compare_exchange_n(&region->count, &count, count + extra, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    region->count += extra;
+    return 1;
+}
+
+/*
+    Memory in the arena allocator is managed in a linear fashion,
+    meaning previously allocated blocks cannot be individually freed or reused.
+    When old_ptr is the most recent allocation of the current region and the
+    region has room, the block simply grows in place. Otherwise a new block is
+    allocated, and the old block remains unused, effectively making it "orphaned."
+*/
+static void *
+arena_realloc_internal(Arena *arena, void *old_ptr, size_t old_size, size_t new_size, const char *tag)
+{
+    unsigned char *new_ptr = NULL, *old_end;
+    int grown = 0;
+    assert(arena != NULL);
+
+    if(new_size <= old_size){
+        return old_ptr;
+    }
+    old_end = (unsigned char*)old_ptr + old_size;
+
+    if(arena->flags & ARENA_LOCKFREE){
+        grown = old_ptr != NULL &&
+                arena_region_extend(arena, __atomic_load_n(&arena->curr, __ATOMIC_ACQUIRE),
+                                    old_end, new_size - old_size, 0);
+        /* Only growing into uncommitted memory needs the mutex */
+        if(!grown && !(arena->flags & ARENA_VIRTUAL)){
+            new_ptr = (unsigned char*)arena_alloc_internal(arena, new_size, ARENA_DEFAULT_ALIGNMENT, 0, NULL);
+        }
+        if(grown || new_ptr != NULL){
+            arena_count_realloc(arena, old_size, grown);
+            /* Growing in place only takes the difference out of the arena */
+            ARENA_PROFILE_RECORD(arena, tag, grown ? new_size - old_size : new_size, 0);
+        }
+    }
+
+    if(!grown && new_ptr == NULL){
+        arena_lock(arena);
+
+        grown = old_ptr != NULL &&
+                arena_region_extend(arena, arena->curr, old_end, new_size - old_size, 1);
+        new_ptr = grown ? NULL : (unsigned char*)arena_alloc_unlocked(arena, new_size, ARENA_DEFAULT_ALIGNMENT);
+        arena_count_realloc(arena, old_size, grown);
+        ARENA_PROFILE_RECORD(arena, tag, grown ? new_size - old_size : new_size, 1);
+        arena_unlock(arena);
+    }
+
+    if(grown){
+        return old_ptr;
+    }
+
+    /* The copy does not need the mutex, only the allocation does, blocks never overlap */
+    if(new_ptr == NULL){
+        return NULL;
+    }
+    if(old_ptr != NULL){
+        arena_memcpy(new_ptr, old_ptr, old_size);
+    }
+
+    return (void*) new_ptr;
+}
+
+void *
+arena_realloc(Arena *arena, void *old_ptr, size_t old_size, size_t new_size)
+{
+    return arena_realloc_internal(arena, old_ptr, old_size, new_size, NULL);
+}
+
+/* This must be called by the owning thread before using the ArenaLocal */
+void
+arena_local_init(ArenaLocal *local, Arena *arena, size_t chunk_size)
+{
+    assert(local != NULL);
+    assert(arena != NULL);
+
+    local->arena      = arena;
+    local->ptr        = NULL;
+    local->end        = NULL;
+    local->chunk_size = chunk_size != 0 ? chunk_size : (size_t)ARENA_LOCAL_CHUNK_SIZE;
+    local->generation = arena->generation;
+    local->counters = arena_counters_zero;
+}
+
+void
+arena_local_flush(ArenaLocal *local)
+{
+    Arena *arena;
+    size_t i;
+
+    assert(local != NULL);
+    assert(local->arena != NULL);
+    arena = local->arena;
+
+    arena_lock(arena);
+    ARENA_COUNT(arena, alloc_count, local->counters.alloc_count);
+    ARENA_COUNT(arena, alloc_bytes, local->counters.alloc_bytes);
+    ARENA_COUNT(arena, realloc_count, local->counters.realloc_count);
+    ARENA_COUNT(arena, realloc_in_place, local->counters.realloc_in_place);
+    ARENA_COUNT(arena, orphaned_bytes, local->counters.orphaned_bytes);
+    if(arena->flags & ARENA_STATS_HISTOGRAM){
+        for(i = 0; i < ARENA_HISTOGRAM_BUCKETS; i++){
+            if(local->counters.histogram[i] != 0){
+                ARENA_COUNT(arena, histogram[i], local->counters.histogram[i]);
+            }
+        }
+    }
+    arena_unlock(arena);
+    local->counters = arena_counters_zero;
+}
+
+void *
+arena_local_alloc(ArenaLocal *local, size_t size)
+{
+    void *ptr;
+    size_t pad;
+
+    assert(local != NULL);
+    assert(local->arena != NULL);
+
+    /* The arena was reset since the chunk was carved, it is no longer ours */
+    if(local->generation != local->arena->generation){
+        local->ptr = NULL;
+        local->end = NULL;
+        local->generation = local->arena->generation;
+    }
+
+    pad = arena_align_padding(local->ptr, ARENA_DEFAULT_ALIGNMENT);
+    if(local->ptr != NULL && pad + size <= (size_t)(local->end - local->ptr)){
+        arena_count_alloc(local->arena->flags, &local->counters, size);
+        ptr = local->ptr + pad;
+        local->ptr += pad + size;
+        return ptr;
+    }
+
+    /*
+        Big requests go straight to the shared arena so they neither waste
+        the current chunk nor force chunks to grow.
+    */
+    if(size > local->chunk_size / 4){
+        return arena_alloc(local->arena, size);
+    }
+
+    /* Refills are rare enough to publish the counters of this thread */
+    arena_count_alloc(local->arena->flags, &local->counters, size);
+    arena_local_flush(local);
+
+    /* The tail of the old chunk (less than chunk_size/4) is abandoned, chunks come back aligned */
+    local->ptr = arena_alloc_internal(local->arena, local->chunk_size, ARENA_DEFAULT_ALIGNMENT, 0, NULL);
+    if(local->ptr == NULL){
+        local->end = NULL;
+        return NULL;
+    }
+    local->end = local->ptr + local->chunk_size;
+
+    ptr = local->ptr;
+    local->ptr += size;
+    return ptr;
+}
+
+void *
+arena_local_realloc(ArenaLocal *local, void *old_ptr, size_t old_size, size_t new_size)
+{
+    void *new_ptr;
+    assert(local != NULL);
+
+    if(new_size <= old_size){
+        return old_ptr;
+    }
+
+    local->counters.realloc_count++;
+
+    /* Last allocation of the chunk: grow in place */
+    if(old_ptr != NULL && (unsigned char*)old_ptr + old_size == local->ptr &&
+       new_size - old_size <= (size_t)(local->end - local->ptr)){
+        local->counters.realloc_in_place++;
+        local->ptr += new_size - old_size;
+        return old_ptr;
+    }
+
+    local->counters.orphaned_bytes += old_size;
+    new_ptr = arena_local_alloc(local, new_size);
+    if(old_ptr != NULL){
+        arena_memcpy(new_ptr, old_ptr, old_size);
+    }
+    return new_ptr;
+}
+
+#ifdef ARENA_PROFILE
+#define ARENA_PROFILE_SLOTS (ARENA_PROFILE_MAX_TAGS * 2)
+
+typedef struct {
+    const char *tag;
+    size_t count;
+    size_t bytes;
+} ArenaProfileEntry;
+
+/* Open-addressed index over a dense entry array, the last entry is ARENA_PROFILE_OTHER_TAG */
+struct ArenaProfile {
+    size_t size;
+    unsigned short slots[ARENA_PROFILE_SLOTS]; /* entry index + 1, 0 is empty */
+    ArenaProfileEntry entries[ARENA_PROFILE_MAX_TAGS];
+};
+
+static int
+arena_tag_equal(const char *a, const char *b)
+{
+    if(a == b){
+        return 1;
+    }
+    while(*a != '\0' && *a == *b){
+        a++;
+        b++;
+    }
+    return *a == *b;
 }
 
+/* FNV-1a */
 static size_t
-arena_align_size(size_t size)
+arena_tag_hash(const char *tag)
 {
-    size_t size_page_aligned, page_size, region_size, size_bytes;
-    region_size = ARENA_REGION_SIZE;
-    page_size = sysconf(_SC_PAGESIZE);
-    size_bytes = region_size + size;
-    size_page_aligned = (size_bytes + page_size - 1) & ~(page_size - 1);
-    return size_page_aligned;
+    size_t hash = 2166136261u;
+    while(*tag != '\0'){
+        hash = (hash ^ (unsigned char)*tag++) * 16777619u;
+    }
+    return hash;
 }
 
-static void
-arena_append_region(Arena *arena, size_t size)
+/*
+    Finds the entry of tag, adding it if there is room and falling back to
+    the ARENA_PROFILE_OTHER_TAG entry. Only the owner of profile may call it.
+    New entries are filled in before their count is published.
+*/
+static ArenaProfileEntry*
+arena_profile_entry(struct ArenaProfile *profile, const char *tag)
 {
-    Region *region;
-    if(size < (size_t)ARENA_REGION_DEFAULT_CAPACITY){
-        size = ARENA_REGION_DEFAULT_CAPACITY;
+    ArenaProfileEntry *entry;
+    size_t slot;
+
+    slot = arena_tag_hash(tag) & (ARENA_PROFILE_SLOTS - 1);
+    while(profile->slots[slot] != 0 &&
+          !arena_tag_equal(profile->entries[profile->slots[slot] - 1].tag, tag)){
+        slot = (slot + 1) & (ARENA_PROFILE_SLOTS - 1);
+    }
+
+    if(profile->slots[slot] != 0){
+        entry = &profile->entries[profile->slots[slot] - 1];
+    } else if(profile->size < ARENA_PROFILE_MAX_TAGS - 1){
+        entry = &profile->entries[profile->size];
+        entry->tag = tag;
+        profile->slots[slot] = (unsigned short)++profile->size;
     } else{
-        size = arena_align_size(size);
+        entry = &profile->entries[ARENA_PROFILE_MAX_TAGS - 1];
     }
-    region = arena_new_region(size);
-    arena->tail->next = region;
-    arena->tail = region;
+    return entry;
 }
 
-/* This must be called at the beginning of the lifetime to initialize the arena*/
-void
-arena_init(Arena *arena, size_t size)
+static struct ArenaProfile*
+arena_profile_new(void)
 {
-    Region *region;
-    int ret;
-    size = arena_align_size(size);
-    region = arena_new_region(size);
-
-    arena->head = region;
-    arena->tail = region;
+    struct ArenaProfile *profile;
 
-    /* Init the mutex */
-    ret = pthread_mutex_init(&arena->mutex, NULL);
-    assert(ret == 0);
+    profile = mmap(NULL, sizeof(*profile), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    assert(profile != MAP_FAILED);
+    profile->entries[ARENA_PROFILE_MAX_TAGS - 1].tag = ARENA_PROFILE_OTHER_TAG;
+    return profile;
 }
 
-static void*
-arena_alloc_unlocked(Arena *arena, size_t size)
+/*
+    A thread with a counter slot records into its own table and never locks.
+    The others share the last table under the mutex, which they hold already
+    unless the allocation took the ARENA_LOCKFREE fast path.
+    Readers merge the tables under the mutex; counts are published with
+    release stores so a reader never sees an entry before its tag.
+*/
+static void
+arena_profile_record(Arena *arena, const char *tag, size_t bytes, int locked)
 {
-    Region *curr;
-    void *ptr;
-
-    assert(arena != NULL);
-    assert(arena->head != NULL);
+    struct ArenaProfile **table, *profile;
+    ArenaProfileEntry *entry;
+    int slot;
 
-    for(curr = arena->head; curr != NULL; curr = curr->next ){
-        if(size <= curr->remaining) {
-            ptr = (void*)(curr->bytes + curr->count);
-            curr->count      += size;
-            curr->remaining  -= size;
+    if(tag == NULL){
+        return;
+    }
 
-            return ptr;
-        }
+    slot = arena_thread_slot_index(arena);
+    if(slot < 0 && !locked){
+        arena_lock(arena);
+        arena_profile_record(arena, tag, bytes, 1);
+        arena_unlock(arena);
+        return;
     }
 
-    // Allocate new region as no space available
-    arena_append_region(arena, size);
-    curr = arena->tail;
-    ptr = (void*)(curr->bytes + curr->count);
+    table = &arena->profiles[slot < 0 ? ARENA_COUNTER_SLOTS : slot];
+    profile = *table;
+    if(profile == NULL){
+        profile = arena_profile_new();
+        __atomic_store_n(table, profile, __ATOMIC_RELEASE);
+    }
 
-    return ptr;
+    entry = arena_profile_entry(profile, tag);
+    __atomic_store_n(&entry->bytes, entry->bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->count, entry->count + 1, __ATOMIC_RELEASE);
 }
 
-
-void*
-arena_alloc(Arena *arena, size_t size)
+/* Tables are mapped on the first tagged allocation of their thread */
+static void
+arena_profile_init(Arena *arena)
 {
-    void *ptr;
-    int ret;
-
-    assert(arena != NULL);
-    assert(arena->head != NULL);
+    int i;
 
-    /* Locking the mutex */
-    ret = pthread_mutex_lock(&arena->mutex);
-    assert(ret == 0);
+    for(i = 0; i <= ARENA_COUNTER_SLOTS; i++){
+        arena->profiles[i] = NULL;
+    }
+}
 
-    ptr = arena_alloc_unlocked(arena, size);
+static void
+arena_profile_free(Arena *arena)
+{
+    int i;
 
-    /* Unlocking the mutex */
-    ret = pthread_mutex_unlock(&arena->mutex);
-    assert(ret == 0);
+    for(i = 0; i <= ARENA_COUNTER_SLOTS; i++){
+        if(arena->profiles[i] != NULL){
+            munmap(arena->profiles[i], sizeof(*arena->profiles[i]));
+            arena->profiles[i] = NULL;
+        }
+    }
+}
 
-    return ptr;
+void*
+arena_alloc_tagged(Arena *arena, size_t size, const char *tag)
+{
+    return arena_alloc_internal(arena, size, ARENA_DEFAULT_ALIGNMENT, 1, tag);
 }
 
-size_t
-arena_strlen(const char *str)
+void*
+arena_realloc_tagged(Arena *arena, void *old_ptr, size_t old_size, size_t new_size, const char *tag)
 {
-    size_t sz = 0;
-    while(*str){
-        sz++;
-        str++;
-    }
-    return sz;
+    return arena_realloc_internal(arena, old_ptr, old_size, new_size, tag);
 }
 
-void *
-arena_memcpy(void *dest, const void *src, size_t n)
+/*
+    Sums every table of arena into a new table, NULL when nothing was
+    tagged. Must be called with the mutex held, the caller unmaps it.
+*/
+static struct ArenaProfile*
+arena_profile_merge(Arena *arena)
 {
-    const char *_src = src;
-    char *_dest = dest;
-    for( ; n !=0; n--){
-        *_dest = *_src;
-        _dest++;
-        _src++;
+    struct ArenaProfile *merged = NULL, *profile;
+    ArenaProfileEntry *src, *dst;
+    size_t i, count;
+    int t;
+
+    for(t = 0; t <= ARENA_COUNTER_SLOTS; t++){
+        profile = __atomic_load_n(&arena->profiles[t], __ATOMIC_ACQUIRE);
+        if(profile == NULL){
+            continue;
+        }
+        if(merged == NULL){
+            merged = arena_profile_new();
+        }
+        for(i = 0; i < ARENA_PROFILE_MAX_TAGS; i++){
+            src = &profile->entries[i];
+            count = __atomic_load_n(&src->count, __ATOMIC_ACQUIRE);
+            if(count == 0){
+                continue;
+            }
+            dst = i == ARENA_PROFILE_MAX_TAGS - 1 ? &merged->entries[i] : arena_profile_entry(merged, src->tag);
+            dst->count += count;
+            dst->bytes += __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+        }
     }
-    return _dest;
+    return merged;
 }
 
+/* Fills order with the entries in use, most bytes first, and returns how many */
+static size_t
+arena_profile_sort(struct ArenaProfile *profile, unsigned short *order)
+{
+    size_t n = 0, i, j;
+    unsigned short idx;
 
-/*
-    Memory in the arena allocator is managed in a linear fashion,
-    meaning previously allocated blocks cannot be individually freed or reused.
-    When reallocating, a new block is allocated, and the old block remains unused,
-    effectively making it "orphaned." This can lead to increased memory usage over time.
+    for(i = 0; i < ARENA_PROFILE_MAX_TAGS; i++){
+        if(profile->entries[i].count == 0){
+            continue;
+        }
+        idx = (unsigned short)i;
+        for(j = n; j > 0 && profile->entries[order[j - 1]].bytes < profile->entries[idx].bytes; j--){
+            order[j] = order[j - 1];
+        }
+        order[j] = idx;
+        n++;
+    }
+    return n;
+}
 
-    TODO: Find a better approach to handle reallocations
-*/
-void *
-arena_realloc(Arena *arena, void *old_ptr, size_t old_size, size_t new_size)
+void
+arena_profile_report(Arena *arena)
 {
-    unsigned char *new_ptr;
-    size_t i;
-    int ret;
+    unsigned short order[ARENA_PROFILE_MAX_TAGS];
+    struct ArenaProfile *profile;
+    ArenaProfileEntry *entry;
+    size_t n, i, total = 0;
+
     assert(arena != NULL);
 
-    if(new_size <= old_size){
-        return old_ptr;
+    printf("=============================\n");
+    arena_lock(arena);
+    profile = arena_profile_merge(arena);
+    arena_unlock(arena);
+    if(profile != NULL){
+        n = arena_profile_sort(profile, order);
+        for(i = 0; i < n; i++){
+            total += profile->entries[order[i]].bytes;
+        }
+        printf("%-40s %12s %16s %7s\n", "Tag", "Count", "Bytes", "Share");
+        for(i = 0; i < n; i++){
+            entry = &profile->entries[order[i]];
+            printf("%-40s %12zu %16zu %6.2f%%\n", entry->tag, entry->count, entry->bytes,
+                   total != 0 ? 100.0 * entry->bytes / total : 0.0);
+        }
+        munmap(profile, sizeof(*profile));
     }
+    printf("=============================\n");
+    printf("\n");
+}
 
-    /* Locking the mutex */
-    ret = pthread_mutex_lock(&arena->mutex);
-    assert(ret == 0);
+void
+arena_profile_dump(Arena *arena, int fd)
+{
+    unsigned short order[ARENA_PROFILE_MAX_TAGS];
+    struct ArenaProfile *profile;
+    ArenaProfileEntry *entry;
+    size_t n, i;
 
-    new_ptr = (unsigned char*)arena_alloc_unlocked(arena, new_size);
+    assert(arena != NULL);
 
-    if(old_ptr != NULL){
-        unsigned char * old_ptr_char = (unsigned char*)old_ptr;
-        for(i = 0; i < old_size; ++i){ /*Assuming no overlap happens*/
-            new_ptr[i] = old_ptr_char[i];
+    arena_lock(arena);
+    profile = arena_profile_merge(arena);
+    arena_unlock(arena);
+    dprintf(fd, "tag,count,bytes\n");
+    if(profile != NULL){
+        n = arena_profile_sort(profile, order);
+        for(i = 0; i < n; i++){
+            entry = &profile->entries[order[i]];
+            dprintf(fd, "%s,%zu,%zu\n", entry->tag, entry->count, entry->bytes);
         }
+        munmap(profile, sizeof(*profile));
     }
-
-    /* Unlocking the mutex */
-    ret = pthread_mutex_unlock(&arena->mutex);
-    assert(ret == 0);
-    return (void*) new_ptr;
 }
+#endif /* ARENA_PROFILE */
 
 static void
 arena_region_dump(Region* region)
@@ -208,16 +1656,58 @@ arena_region_dump(Region* region)
     printf("Starts at:  %p\n", (void*)region->bytes);
     printf("Next:       %p\n", (void*)region->next);
     printf("Capacity:   %zu bytes\n", region->capacity);
+    printf("Committed:  %zu bytes\n", region->committed);
     printf("Used:       %zu bytes\n", region->count);
-    printf("Free:       %zu bytes\n", region->remaining);
+    printf("Free:       %zu bytes\n", region->capacity - region->count);
     printf("\n");
 }
 
+void
+arena_stats(Arena *arena, ArenaStats *stats)
+{
+    Region *curr;
+    size_t *src, *dst, i, slot;
+    int ret;
+
+    assert(arena != NULL);
+    assert(stats != NULL);
+
+    stats->region_count    = 0;
+    stats->mapped_bytes    = 0;
+    stats->committed_bytes = 0;
+    stats->used_bytes      = 0;
+
+    /* The mutex keeps the chain stable, lock-free counts may still move */
+    ret = pthread_mutex_lock(&arena->mutex);
+    assert(ret == 0);
+    src = (size_t*)&arena->counters;
+    dst = (size_t*)&stats->counters;
+    for(i = 0; i < sizeof(ArenaCounters) / sizeof(size_t); i++){
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    for(slot = 0; arena->slots != NULL && slot < ARENA_COUNTER_SLOTS; slot++){
+        src = (size_t*)ARENA_SLOT(arena, slot);
+        for(i = 0; i < sizeof(ArenaCounters) / sizeof(size_t); i++){
+            dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+    }
+    for(curr = arena->head; curr != NULL; curr = curr->next){
+        stats->region_count++;
+        stats->mapped_bytes    += ARENA_REGION_SIZE + curr->capacity;
+        stats->committed_bytes += ARENA_REGION_SIZE + __atomic_load_n(&curr->committed, __ATOMIC_ACQUIRE);
+        stats->used_bytes      += __atomic_load_n(&curr->count, __ATOMIC_RELAXED);
+    }
+    stats->high_water = arena->high_water > stats->used_bytes ? arena->high_water : stats->used_bytes;
+    ret = pthread_mutex_unlock(&arena->mutex);
+    assert(ret == 0);
+}
+
 void
 arena_dump(Arena *arena)
 {
     Region *curr;
-    size_t cnt = 0;
+    ArenaStats stats;
+    size_t cnt = 0, i;
 
     assert(arena != NULL);
 
@@ -227,19 +1717,167 @@ arena_dump(Arena *arena)
         arena_region_dump(curr);
         cnt++;
     }
+
+    arena_stats(arena, &stats);
+    printf("===> Stats:\n");
+    printf("Regions:    %zu\n", stats.region_count);
+    printf("Mapped:     %zu bytes\n", stats.mapped_bytes);
+    printf("Committed:  %zu bytes\n", stats.committed_bytes);
+    printf("Used:       %zu bytes\n", stats.used_bytes);
+    printf("High water: %zu bytes\n", stats.high_water);
+    printf("Allocs:     %zu (%zu bytes)\n", stats.counters.alloc_count, stats.counters.alloc_bytes);
+    printf("Reallocs:   %zu (%zu in place, %zu bytes orphaned)\n", stats.counters.realloc_count,
+           stats.counters.realloc_in_place, stats.counters.orphaned_bytes);
+    printf("mmap:       %zu (%zu from cache)\n", stats.counters.mmap_calls, stats.counters.cache_hits);
+    printf("munmap:     %zu\n", stats.counters.munmap_calls);
+    printf("Contended:  %zu\n", stats.counters.lock_contended);
+    if(arena->flags & ARENA_STATS_HISTOGRAM){
+        for(i = 0; i < ARENA_HISTOGRAM_BUCKETS; i++){
+            if(stats.counters.histogram[i] != 0){
+                printf("  [2^%zu, 2^%zu): %zu\n", i, i + 1, stats.counters.histogram[i]);
+            }
+        }
+    }
     printf("=============================\n");
     printf("\n");
 }
 
+/* Gives the pages inside [ptr, ptr + size) back to the kernel, the mapping stays */
+static void
+arena_advise_free(Arena *arena, unsigned char *ptr, size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned char *start, *end;
+
+    start = ptr + arena_align_padding(ptr, page_size);
+    end = (unsigned char*)((uintptr_t)(ptr + size) & ~(uintptr_t)(page_size - 1));
+    if(end <= start){
+        return;
+    }
+#ifdef MADV_FREE
+    if((arena->flags & ARENA_RESET_FREE) && madvise(start, end - start, MADV_FREE) == 0){
+        return;
+    }
+#endif
+    madvise(start, end - start, MADV_DONTNEED);
+}
+
+/* ARENA_VIRTUAL: drops the commit of everything past the first keep payload bytes */
+static void
+arena_region_decommit(Arena *arena, Region *region, size_t keep)
+{
+    size_t granularity, target;
+    int ret;
+
+    granularity = arena->flags & (ARENA_HUGEPAGE | ARENA_HUGETLB) ?
+                  ARENA_HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    target = ARENA_REGION_SIZE + keep;
+    target = ((target + granularity - 1) & ~(granularity - 1)) - ARENA_REGION_SIZE;
+    if(target >= region->committed){
+        return;
+    }
+
+    ret = madvise(region->bytes + target, region->committed - target, MADV_DONTNEED);
+    assert(ret == 0);
+    ret = mprotect(region->bytes + target, region->committed - target, PROT_NONE);
+    assert(ret == 0);
+    region->committed = target;
+}
+
+/*
+    Dedicated regions are linked in front of the cursor, so one taken while the
+    cursor was on the ARENA_VIRTUAL region ends up ahead of it. Once everything
+    is empty the reservation goes back to the head, where arena_trim keeps it.
+*/
+static void
+arena_relink_virtual(Arena *arena)
+{
+    Region *prev = NULL, *region = arena->head;
+
+    while(!(region->flags & ARENA_VIRTUAL)){
+        prev = region;
+        region = region->next;
+    }
+    if(prev == NULL){
+        return;
+    }
+    prev->next = region->next;
+    if(arena->tail == region){
+        arena->tail = prev;
+    }
+    arena_link_region(arena, NULL, region);
+}
+
+/*
+    Reset policy: keep max(retain, high-water mark) bytes of regions hot and
+    give the rest back, by unmapping it (ARENA_RESET_UNMAP) or advising it
+    away (ARENA_RESET_DONTNEED / ARENA_RESET_FREE). The high-water mark is
+    the usage of the cycle that just ended, or a decayed older peak, so the
+    retained size follows recent usage instead of the all-time peak.
+*/
+static void
+arena_trim(Arena *arena, size_t used)
+{
+    Region *curr, *last, *next;
+    size_t target, kept;
+
+    arena->high_water -= arena->high_water / 4;
+    if(used > arena->high_water){
+        arena->high_water = used;
+    }
+    target = arena->retain > arena->high_water ? arena->retain : arena->high_water;
+
+    /* The head region is always kept, the ARENA_VIRTUAL one is trimmed in place */
+    last = arena->head;
+    if(arena->flags & ARENA_VIRTUAL){
+        if(arena->flags & ARENA_RESET_UNMAP){
+            arena_region_decommit(arena, last, target);
+        } else if(target < last->committed){
+            arena_advise_free(arena, last->bytes + target, last->committed - target);
+        }
+    }
+    kept = last->committed;
+    while(last->next != NULL && kept < target){
+        last = last->next;
+        kept += last->committed;
+    }
+
+    for(curr = last->next; curr != NULL; curr = next){
+        next = curr->next;
+        if(arena->flags & ARENA_RESET_UNMAP){
+            arena_free_region(arena, curr);
+        } else{
+            arena_advise_free(arena, curr->bytes, curr->committed);
+        }
+    }
+    if(arena->flags & ARENA_RESET_UNMAP){
+        last->next = NULL;
+        arena->tail = last;
+    }
+}
+
 void
 arena_reset(Arena *arena){
     Region *curr;
+    size_t used = 0;
     int ret;
     assert(arena != NULL);
 
     for(curr = arena->head; curr != NULL; curr = curr->next){
+        used += curr->count;
         curr->count = 0;
-        curr->remaining = curr->capacity;
+    }
+    if(arena->flags & ARENA_VIRTUAL){
+        arena_relink_virtual(arena);
+    }
+    if(arena->flags & ARENA_RESET_TRIM){
+        arena_trim(arena, used);
+    }
+    arena->curr = arena->head;
+    arena->prev = NULL;
+    arena->generation++;
+    if(arena->flags & ARENA_FILE){
+        arena_set_root(arena, NULL);
     }
 
     /* Safe to destroy - no other threads should be using it */
@@ -251,13 +1889,93 @@ arena_reset(Arena *arena){
     assert(ret == 0);
 }
 
+ArenaMark
+arena_mark(Arena *arena)
+{
+    ArenaMark mark;
+    assert(arena != NULL);
+    assert(arena->curr != NULL);
+
+    mark.prev   = arena->prev;
+    mark.region = arena->curr;
+    mark.count  = arena->curr->count;
+    return mark;
+}
+
+/*
+    Everything allocated since the mark lives in one of:
+      - mark.region past mark.count;
+      - dedicated regions linked between mark.prev and mark.region;
+      - the regions from mark.region->next up to the current cursor.
+    Regions after the cursor are fresh and left alone, so a rewind costs
+    O(regions used since the mark).
+*/
 static void
-arena_free_region(Region* region)
+arena_rewind_regions(Arena *arena, ArenaMark mark, int release)
 {
-    assert(region != NULL);
-    size_t size_bytes = ARENA_REGION_SIZE + region->capacity;
-    int ret = munmap(region, size_bytes);
-    assert(ret == 0);
+    Region *curr, *next, *last;
+
+    assert(arena != NULL);
+    assert(mark.region != NULL);
+
+    /* Dedicated regions inserted before the marked region */
+    curr = mark.prev != NULL ? mark.prev->next : arena->head;
+    for(; curr != mark.region; curr = next){
+        next = curr->next;
+        if(release){
+            arena_free_region(arena, curr);
+        } else{
+            /* Recycle it as a fresh region at the end of the list */
+            curr->count = 0;
+            curr->next = NULL;
+            arena->tail->next = curr;
+            arena->tail = curr;
+        }
+    }
+    if(mark.prev != NULL){
+        mark.prev->next = mark.region;
+    } else{
+        arena->head = mark.region;
+    }
+
+    /* Regions the cursor moved through since the mark */
+    last = arena->curr;
+    if(last != mark.region){
+        for(curr = mark.region->next; ; curr = next){
+            next = curr->next;
+            if(release){
+                arena_free_region(arena, curr);
+            } else{
+                curr->count = 0;
+            }
+            if(curr == last){
+                break;
+            }
+        }
+        if(release){
+            mark.region->next = next;
+            if(next == NULL){
+                arena->tail = mark.region;
+            }
+        }
+    }
+
+    mark.region->count = mark.count;
+    arena->curr = mark.region;
+    arena->prev = mark.prev;
+    arena->generation++;
+}
+
+void
+arena_rewind(Arena *arena, ArenaMark mark)
+{
+    arena_rewind_regions(arena, mark, 0);
+}
+
+void
+arena_rewind_release(Arena *arena, ArenaMark mark)
+{
+    arena_rewind_regions(arena, mark, 1);
 }
 
 void
@@ -266,15 +1984,155 @@ arena_destroy(Arena *arena)
     Region* curr, *temp;
     int ret;
 
-    for(curr = arena->head; curr != NULL;){
-        temp = curr;
-        curr = curr->next;
-        arena_free_region(temp);
+    if(arena->flags & ARENA_FILE){
+        ret = munmap(ARENA_FILE_HEADER(arena), ARENA_FILE_HEADER_SIZE + ARENA_REGION_SIZE + arena->head->capacity);
+        assert(ret == 0);
+        close(arena->file);
+        arena->file = -1;
+    } else{
+        for(curr = arena->head; curr != NULL;){
+            temp = curr;
+            curr = curr->next;
+            arena_free_region(arena, temp);
+        }
     }
     arena->head = NULL;
     arena->tail = NULL;
+    arena->curr = NULL;
+    arena->prev = NULL;
+    if(arena->slots != NULL){
+        munmap(arena->slots, ARENA_COUNTER_SLOTS * ARENA_SLOT_STRIDE);
+        arena->slots = NULL;
+    }
+    ARENA_PROFILE_FREE(arena);
 
     /* Safe to destroy - no other threads should be using it */
     ret = pthread_mutex_destroy(&arena->mutex);
     assert(ret == 0);
 }
+
+/* A header fit to map: ours, same layout, and a mapping that can hold the file */
+static int
+arena_file_header_valid(const ArenaFileHeader *header, off_t file_size)
+{
+    return header->magic == ARENA_FILE_MAGIC &&
+           header->version == ARENA_FILE_VERSION &&
+           header->region_size == ARENA_REGION_SIZE &&
+           header->base % (uint64_t)ARENA_PAGE_SIZE == 0 &&
+           header->reserve > ARENA_FILE_HEADER_SIZE + ARENA_REGION_SIZE &&
+           (uint64_t)file_size >= ARENA_FILE_HEADER_SIZE + ARENA_REGION_SIZE &&
+           (uint64_t)file_size <= header->reserve;
+}
+
+int
+_arena_open_file(Arena *arena, const char *path, ArenaOpts opts)
+{
+    ArenaFileHeader header;
+    struct stat st;
+    unsigned char *base;
+    Region *region;
+    size_t commit;
+    int fd, fresh, map_flags = MAP_SHARED;
+
+    assert(arena != NULL);
+    assert(path != NULL);
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    /* Held until arena_destroy closes fd, a second opener fails instead of sharing the bump pointer */
+    if(flock(fd, LOCK_EX | LOCK_NB) != 0){
+        close(fd);
+        return -1;
+    }
+    if(fstat(fd, &st) != 0){
+        close(fd);
+        return -1;
+    }
+
+    fresh = st.st_size == 0;
+    if(fresh){
+        header.magic = ARENA_FILE_MAGIC;
+        header.version = ARENA_FILE_VERSION;
+        header.region_size = ARENA_REGION_SIZE;
+        header.base = (uintptr_t)(opts.base != NULL ? opts.base : ARENA_FILE_DEFAULT_BASE);
+        header.reserve = arena_align_size(opts.reserve != 0 ? opts.reserve : ARENA_FILE_DEFAULT_RESERVE);
+        header.root = 0;
+        commit = ARENA_FILE_HEADER_SIZE + arena_align_size(ARENA_COMMIT_SIZE);
+        if(header.base % (uint64_t)ARENA_PAGE_SIZE != 0 || commit > header.reserve ||
+           ftruncate(fd, commit) != 0){
+            close(fd);
+            return -1;
+        }
+        st.st_size = commit;
+    } else if(pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+              !arena_file_header_valid(&header, st.st_size)){
+        close(fd);
+        return -1;
+    }
+
+    /* Never replace an existing mapping, the address is a hint that has to be taken as is */
+#ifdef MAP_FIXED_NOREPLACE
+    map_flags |= MAP_FIXED_NOREPLACE;
+#endif
+    base = mmap((void*)(uintptr_t)header.base, header.reserve, PROT_READ | PROT_WRITE, map_flags, fd, 0);
+    if(base == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+    if(base != (unsigned char*)(uintptr_t)header.base){
+        munmap(base, header.reserve);
+        close(fd);
+        return -1;
+    }
+
+    region = (Region*)(base + ARENA_FILE_HEADER_SIZE);
+    if(fresh){
+        *(ArenaFileHeader*)base = header;
+        region->count = 0;
+    }
+    /* Everything but count is rebuilt, count is the bump pointer left by the last run */
+    region->next       = NULL;
+    region->capacity   = header.reserve - ARENA_FILE_HEADER_SIZE - ARENA_REGION_SIZE;
+    region->committed  = st.st_size - ARENA_FILE_HEADER_SIZE - ARENA_REGION_SIZE;
+    region->flags      = ARENA_VIRTUAL | ARENA_FILE;
+    region->bytes      = (unsigned char*)region + ARENA_REGION_SIZE;
+    if(region->count > region->committed){
+        munmap(base, header.reserve);
+        close(fd);
+        return -1;
+    }
+
+    arena->flags = (opts.flags & (ARENA_LOCKFREE | ARENA_STATS_HISTOGRAM)) | ARENA_VIRTUAL | ARENA_FILE;
+    arena->counters = arena_counters_zero;
+    arena->counters.mmap_calls = 1;
+    arena_init_region(arena, region, opts);
+    arena->file = fd;
+    return !fresh;
+}
+
+int
+arena_sync(Arena *arena)
+{
+    assert(arena != NULL);
+    assert(arena->flags & ARENA_FILE);
+    return msync(ARENA_FILE_HEADER(arena),
+                 ARENA_FILE_HEADER_SIZE + ARENA_REGION_SIZE + arena->head->count, MS_SYNC);
+}
+
+void
+arena_set_root(Arena *arena, void *root)
+{
+    assert(arena != NULL);
+    assert(arena->flags & ARENA_FILE);
+    __atomic_store_n(&ARENA_FILE_HEADER(arena)->root, (uintptr_t)root, __ATOMIC_RELEASE);
+}
+
+void *
+arena_root(Arena *arena)
+{
+    assert(arena != NULL);
+    assert(arena->flags & ARENA_FILE);
+    return (void*)(uintptr_t)__atomic_load_n(&ARENA_FILE_HEADER(arena)->root, __ATOMIC_ACQUIRE);
+}
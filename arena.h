@@ -22,6 +22,8 @@
 #define ARENA_LIB
 
 #include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
 
 typedef struct Region Region;
@@ -29,17 +31,112 @@ typedef struct Region Region;
 struct Region{
     Region *next;
     size_t capacity;
-    size_t count;
-    size_t remaining;
+    size_t committed; /* accessible bytes, less than capacity only for ARENA_VIRTUAL */
+    size_t count;     /* free space is committed - count */
+    unsigned flags;   /* ARENA_VIRTUAL / ARENA_HUGEPAGE / ARENA_HUGETLB mapping it was created with */
     unsigned char *bytes;
 };
 
+/* Arena flags, passed as arena_init(&arena, size, .flags = ...) */
+#define ARENA_LOCKFREE  (1u << 0)   /* CAS fast path on the current region, mutex only to change regions */
+#define ARENA_VIRTUAL   (1u << 1)   /* reserve .reserve bytes up front and commit them as needed */
+#define ARENA_HUGEPAGE  (1u << 2)   /* 2 MB aligned regions advised with MADV_HUGEPAGE */
+#define ARENA_HUGETLB   (1u << 3)   /* MAP_HUGETLB regions, falls back to ARENA_HUGEPAGE */
+#define ARENA_POPULATE  (1u << 4)   /* prefault regions (MAP_POPULATE) instead of faulting on first touch */
+
+/*
+    arena_reset policy: keep max(.retain, recent high-water mark) bytes of
+    regions hot and return the rest to the OS in one of these ways.
+*/
+#define ARENA_RESET_UNMAP     (1u << 5)   /* munmap (ARENA_VIRTUAL: decommit) the rest */
+#define ARENA_RESET_DONTNEED  (1u << 6)   /* keep the mappings, drop the pages with MADV_DONTNEED */
+#define ARENA_RESET_FREE      (1u << 7)   /* like DONTNEED but lazy with MADV_FREE, if available */
+#define ARENA_RESET_TRIM      (ARENA_RESET_UNMAP | ARENA_RESET_DONTNEED | ARENA_RESET_FREE)
+
+#define ARENA_STATS_HISTOGRAM (1u << 8)   /* keep the allocation size histogram in ArenaCounters */
+#define ARENA_FILE            (1u << 9)   /* set by arena_open_file, the region is a shared file mapping */
+
+typedef struct {
+    unsigned flags;
+    size_t reserve;    /* ARENA_VIRTUAL address space, 0 means ARENA_VIRTUAL_DEFAULT_RESERVE */
+    size_t retain;     /* bytes arena_reset always keeps hot with ARENA_RESET_TRIM */
+    void *base;        /* arena_open_file mapping address of a new file, NULL means ARENA_FILE_DEFAULT_BASE */
+} ArenaOpts;
+
+/*
+    Cumulative event counters, always on and never cleared by arena_reset.
+    They are plain adds under the mutex. On ARENA_LOCKFREE arenas each thread
+    counts its allocations in a counter slot of its own (Arena.slots) that
+    arena_stats sums, and an ArenaLocal counts privately and adds its totals
+    when it refills or on arena_local_flush.
+*/
+#define ARENA_HISTOGRAM_BUCKETS 32
+#define ARENA_COUNTER_SLOTS     64  /* threads past this count in the shared counters with atomics */
+
+typedef struct {
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t realloc_count;     /* arena_realloc calls that grew a block */
+    size_t realloc_in_place;  /* ... of which grew without moving */
+    size_t orphaned_bytes;    /* old blocks left behind by moving reallocs */
+    size_t mmap_calls;
+    size_t munmap_calls;
+    size_t cache_hits;        /* regions reused from the region cache */
+    size_t lock_contended;    /* mutex acquisitions that had to wait */
+    size_t histogram[ARENA_HISTOGRAM_BUCKETS]; /* allocations of [2^i, 2^(i+1)) bytes, with ARENA_STATS_HISTOGRAM */
+} ArenaCounters;
+
+/* Snapshot returned by arena_stats */
+typedef struct {
+    ArenaCounters counters;
+    size_t region_count;
+    size_t mapped_bytes;      /* capacity of all regions */
+    size_t committed_bytes;
+    size_t used_bytes;        /* handed out since the last reset, padding included */
+    size_t high_water;        /* max(used_bytes, decayed per-cycle peak) */
+} ArenaStats;
+
 typedef struct {
     Region *head;
     Region *tail;
+    Region *curr;      /* allocation cursor, regions before it are full, after it fresh */
+    Region *prev;      /* region linked just before curr, NULL when curr is the head */
+    unsigned flags;
+    size_t retain;
+    size_t high_water; /* bytes used per reset cycle, decayed by a quarter each reset */
+    size_t generation; /* bumped by arena_reset to invalidate ArenaLocal chunks */
+    ArenaCounters counters;
+    ArenaCounters *slots; /* ARENA_LOCKFREE: ARENA_COUNTER_SLOTS per-thread counters, NULL otherwise */
+    int file;          /* ARENA_FILE backing descriptor, -1 otherwise */
+#ifdef ARENA_PROFILE
+    struct ArenaProfile *profiles[ARENA_COUNTER_SLOTS + 1]; /* per-tag tables of each counter slot, then the shared one */
+#endif
     pthread_mutex_t mutex;
 } Arena;
 
+/* Save point returned by arena_mark, see arena_rewind */
+typedef struct {
+    Region *prev;
+    Region *region;
+    size_t count;
+} ArenaMark;
+
+/*
+    Per-thread front end of a shared Arena. Each thread owns one ArenaLocal and
+    bump-allocates from its own chunk without locking; the shared arena (and its
+    mutex) is only touched to carve a new chunk. Chunks live inside the arena's
+    regions, so arena_reset/arena_destroy still reclaim everything.
+    An ArenaLocal must never be shared between threads.
+*/
+typedef struct {
+    Arena *arena;
+    unsigned char *ptr;
+    unsigned char *end;
+    size_t chunk_size;
+    size_t generation;
+    ArenaCounters counters; /* not yet added to the arena's */
+} ArenaLocal;
+
 
 #define ARENA_ARR(name, type) \
     typedef struct name { \
@@ -48,15 +145,101 @@ typedef struct {
         size_t capacity; \
     } name
 
-#define ARENA_REGION_SIZE        (sizeof(Region))
+/* C99 has no max_align_t, this union is as strictly aligned as any scalar type */
+typedef union {
+    long double ld;
+    long long ll;
+    double d;
+    void *p;
+    void (*fp)(void);
+} ArenaMaxAlign;
+
+#define ARENA_DEFAULT_ALIGNMENT  (offsetof(struct { char c; ArenaMaxAlign a; }, a))
+#define ARENA_CACHE_LINE         64
+
+/* Region header rounded up to a cache line, so every payload starts cache-line aligned */
+#define ARENA_REGION_SIZE        ((sizeof(Region) + ARENA_CACHE_LINE - 1) & ~(size_t)(ARENA_CACHE_LINE - 1))
 #define ARENA_PAGE_SIZE          (sysconf(_SC_PAGESIZE))
 #define ARENA_SIZE_ARR(arr)      (sizeof(arr) / sizeof((arr)[0]))
 
 #define ARENA_REGION_DEFAULT_CAPACITY   (ARENA_PAGE_SIZE * 2)
+/*
+    Process-wide region cache: regions released by arena_destroy, arena_reset
+    trimming and arena_rewind_release are kept for the next arena instead of
+    being unmapped. Limits are set with arena_cache_config.
+*/
+#define ARENA_CACHE_BUCKETS                 16
+#define ARENA_CACHE_MIN_SIZE                ((size_t)4096)
+#define ARENA_CACHE_MAX_SIZE                ((ARENA_CACHE_MIN_SIZE << ARENA_CACHE_BUCKETS) - 1)
+#define ARENA_CACHE_DEFAULT_MAX_BYTES       ((size_t)64 << 20)
+#define ARENA_CACHE_DEFAULT_MAX_PER_BUCKET  64
+
+#define ARENA_HUGE_PAGE_SIZE            ((size_t)2 << 20)
+#define ARENA_LOCAL_CHUNK_SIZE          (ARENA_PAGE_SIZE * 16)
+
+/*
+    ARENA_VIRTUAL: the first region reserves the whole address range with
+    PROT_NONE and is committed with mprotect at least ARENA_COMMIT_SIZE at a
+    time, so it grows in place. Once the reservation is used up the arena
+    falls back to appending ordinary regions.
+*/
+#if SIZE_MAX > 0xFFFFFFFF
+#define ARENA_VIRTUAL_DEFAULT_RESERVE   ((size_t)1 << 36)
+#else
+#define ARENA_VIRTUAL_DEFAULT_RESERVE   ((size_t)1 << 30)
+#endif
+#define ARENA_COMMIT_SIZE               (ARENA_PAGE_SIZE * 64)
+
+/* Requests bigger than this get a dedicated region instead of retiring the current one */
+#define ARENA_LARGE_ALLOC_SIZE          (ARENA_REGION_DEFAULT_CAPACITY / 4)
+
+/*
+    File-backed arena, for data that should outlive the process:
+        if(arena_open_file(&arena, "tables.arena") == 0){
+            ... first run: build, then arena_set_root(&arena, tables) ...
+        }
+        tables = arena_root(&arena);
+        ...
+        arena_sync(&arena);
+        arena_destroy(&arena);
+    The file is one ARENA_VIRTUAL region mapped MAP_SHARED at the same
+    address in every process (.base of the run that created it), so pointers
+    stored in the arena stay valid and a snapshot is usable as soon as it is
+    mapped, with no parse step. Committing grows the file instead of
+    mprotect'ing. The file starts with an ArenaFileHeader page that is
+    checked on open: magic, version, the Region layout and the base address.
+    The bump pointer lives in the file too, so reopening continues after the
+    last allocation. Allocations past .reserve return NULL, a file arena
+    never spills into anonymous regions; huge pages and reset trimming are
+    ignored. arena_reset also clears the root.
+    Only one process may have the file open at a time: arena_open_file takes
+    an exclusive flock on it and returns -1 while another arena holds it,
+    arena_destroy releases it.
+*/
+#define ARENA_FILE_MAGIC        ((uint64_t)0x414e4552414b5443) /* "CTKARENA" */
+#define ARENA_FILE_VERSION      1
+#define ARENA_FILE_HEADER_SIZE  ((size_t)4096)
+#if SIZE_MAX > 0xFFFFFFFF
+#define ARENA_FILE_DEFAULT_BASE     ((void*)(uintptr_t)0x500000000000)
+#define ARENA_FILE_DEFAULT_RESERVE  ((size_t)1 << 36)
+#else
+#define ARENA_FILE_DEFAULT_BASE     ((void*)(uintptr_t)0x60000000)
+#define ARENA_FILE_DEFAULT_RESERVE  ((size_t)1 << 28)
+#endif
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t region_size; /* ARENA_REGION_SIZE of the writer */
+    uint64_t base;        /* address the file must be mapped at */
+    uint64_t reserve;     /* bytes of address space mapped, the file never grows past it */
+    uint64_t root;        /* arena_set_root */
+} ArenaFileHeader;
 
 
 #define ARENA_ARR_INIT_CAPACITY 256
 
+/* items come from arena_realloc, so they are aligned for any scalar element type */
 #define arena_arr_append(arena, arr, item) \
     do{ \
         if((arr)->size >= (arr)->capacity) { \
@@ -72,15 +255,89 @@ typedef struct {
     } while(0)
 
 /* Functions declarations*/
-void arena_init(Arena *arena, size_t size);
-void *arena_alloc(Arena *arena, size_t size);
+void _arena_init(Arena *arena, size_t size, ArenaOpts opts);
+#define arena_init(arena, size, ...) \
+    _arena_init(arena, size, (ArenaOpts){__VA_ARGS__})
+
+void *arena_alloc(Arena *arena, size_t size); /* aligned to ARENA_DEFAULT_ALIGNMENT */
+void *arena_alloc_aligned(Arena *arena, size_t size, size_t align); /* align must be a power of two */
 void *arena_realloc(Arena *arena, void *oldptr, size_t oldsz, size_t newsz);
 size_t arena_strlen(const char *str); /* this is implemented  instead of including <string.h>*/
-void *arena_memcpy(void *dest, const void *src, size_t n); /* just like arena_strlen*/
+void *arena_memcpy(void *dest, const void *src, size_t n); /* just like arena_strlen, returns dest + n */
+
+/* Kernels behind arena_memcpy/arena_strlen, levels the CPU lacks fall back to the best it has */
+enum { ARENA_SIMD_AUTO, ARENA_SIMD_WORD, ARENA_SIMD_SSE2, ARENA_SIMD_AVX2 };
+int arena_simd_select(int level); /* returns the level now in use */
+int arena_simd_level(void);       /* level in use, string.c kernels follow it too */
 void arena_dump(Arena *arena);
+void arena_stats(Arena *arena, ArenaStats *out);
+
+/*
+    Call-site profiling, compiled in with -DARENA_PROFILE (the whole program
+    must agree, it changes the layout of Arena). Tagged allocations add their
+    bytes and count to the tag; tags are compared by content and must outlive
+    the arena, string literals are the intended use:
+        p = arena_alloc_tagged(&arena, size, "parser");
+        p = arena_alloc_here(&arena, size);          tag is "file.c:123"
+    arena_profile_report prints the tags sorted by bytes, arena_profile_dump
+    writes "tag,count,bytes" CSV to fd. Without ARENA_PROFILE the tagged calls
+    are plain arena_alloc/arena_realloc and the rest expands to nothing.
+*/
+#define ARENA_PROFILE_MAX_TAGS   1024
+#define ARENA_PROFILE_OTHER_TAG  "(other)"  /* collects tags once the table is full */
+
+#define ARENA_STRINGIFY_(x)      #x
+#define ARENA_STRINGIFY(x)       ARENA_STRINGIFY_(x)
+#define ARENA_TAG_HERE           __FILE__ ":" ARENA_STRINGIFY(__LINE__)
+
+#ifdef ARENA_PROFILE
+void *arena_alloc_tagged(Arena *arena, size_t size, const char *tag);
+void *arena_realloc_tagged(Arena *arena, void *oldptr, size_t oldsz, size_t newsz, const char *tag);
+void arena_profile_report(Arena *arena);
+void arena_profile_dump(Arena *arena, int fd);
+#else
+#define arena_alloc_tagged(arena, size, tag)                  arena_alloc(arena, size)
+#define arena_realloc_tagged(arena, oldptr, oldsz, newsz, tag) arena_realloc(arena, oldptr, oldsz, newsz)
+#define arena_profile_report(arena)                            ((void)0)
+#define arena_profile_dump(arena, fd)                          ((void)0)
+#endif
+#define arena_alloc_here(arena, size) arena_alloc_tagged(arena, size, ARENA_TAG_HERE)
+
+/* Region cache limits, max_bytes 0 disables the cache. arena_cache_drain unmaps every cached region */
+void arena_cache_config(size_t max_bytes, size_t max_per_bucket);
+void arena_cache_drain(void);
+
+/* Thread-local front end, see ArenaLocal. chunk_size 0 means ARENA_LOCAL_CHUNK_SIZE */
+void arena_local_init(ArenaLocal *local, Arena *arena, size_t chunk_size);
+void *arena_local_alloc(ArenaLocal *local, size_t size);
+void *arena_local_realloc(ArenaLocal *local, void *old_ptr, size_t old_size, size_t new_size);
+void arena_local_flush(ArenaLocal *local); /* adds the local counters to the arena's */
 
 /* Must be used only when no other threads are using the arena*/
 void arena_reset(Arena *arena);
+
+/*
+    Scoped scratch allocations:
+        ArenaMark m = arena_mark(&arena);
+        ... allocate ...
+        arena_rewind(&arena, m);
+    Rewinding frees everything allocated since the mark. arena_rewind keeps the
+    regions that were used for reuse, arena_rewind_release unmaps them. Marks
+    must be rewound in LIFO order, and like arena_reset only while no other
+    thread is using the arena.
+*/
+ArenaMark arena_mark(Arena *arena);
+void arena_rewind(Arena *arena, ArenaMark mark);
+void arena_rewind_release(Arena *arena, ArenaMark mark);
 void arena_destroy(Arena *arena);
 
+/* Persistent arenas, see ArenaFileHeader. 1 when a snapshot was mapped back, 0 for a new file, -1 on errors */
+int _arena_open_file(Arena *arena, const char *path, ArenaOpts opts);
+#define arena_open_file(arena, path, ...) \
+    _arena_open_file(arena, path, (ArenaOpts){__VA_ARGS__})
+
+int arena_sync(Arena *arena);               /* msync of the header and everything allocated, 0 or -1 */
+void arena_set_root(Arena *arena, void *root);
+void *arena_root(Arena *arena);
+
 #endif
@@ -0,0 +1,88 @@
+/*
+    Copyright (C) 2025  Mina Albert Saeed <mina.albert.saeed@gmail.com>
+
+    Page backing benchmark: page faults and allocation throughput of a large
+    arena with plain, prefaulted, transparent huge page and hugetlb regions.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "bench.h"
+#include "../arena.h"
+
+#define BLOCK_SIZE  (64 * 1024)
+
+typedef struct {
+    const char *name;
+    unsigned flags;
+} Mode;
+
+static const Mode modes[] = {
+    { "plain",             0 },
+    { "populate",          ARENA_POPULATE },
+    { "hugepage",          ARENA_HUGEPAGE },
+    { "hugepage+populate", ARENA_HUGEPAGE | ARENA_POPULATE },
+    { "hugetlb",           ARENA_HUGETLB },
+    { "virtual",           ARENA_VIRTUAL },
+    { "virtual+hugepage",  ARENA_VIRTUAL | ARENA_HUGEPAGE },
+};
+
+static long
+minor_faults(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t total_mb, total, done, i;
+    double start, elapsed;
+    long faults;
+    unsigned char *p;
+    Arena arena;
+    size_t m;
+
+    total_mb = argc > 1 ? (size_t)atol(argv[1]) : 512;
+    total = total_mb << 20;
+
+    printf("mode,megabytes,seconds,minor_faults,gb_per_sec\n");
+    for(m = 0; m < ARENA_SIZE_ARR(modes); ++m){
+        faults = minor_faults();
+        start = now_sec();
+
+        /* Region growth and first touch are both part of what is measured */
+        arena_init(&arena, 1024 * 1024, .flags = modes[m].flags, .reserve = total * 2);
+        for(done = 0; done < total; done += BLOCK_SIZE){
+            p = arena_alloc(&arena, BLOCK_SIZE);
+            for(i = 0; i < BLOCK_SIZE; i += 64){
+                p[i] = (unsigned char)i;
+            }
+        }
+
+        elapsed = now_sec() - start;
+        faults = minor_faults() - faults;
+        arena_destroy(&arena);
+
+        printf("%s,%zu,%.4f,%ld,%.2f\n", modes[m].name, total_mb, elapsed, faults,
+               total / elapsed / 1e9);
+    }
+    return 0;
+}
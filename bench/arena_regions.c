@@ -0,0 +1,88 @@
+/*
+    Copyright (C) 2025  Mina Albert Saeed <mina.albert.saeed@gmail.com>
+
+    Region selection benchmark: allocation cost while an arena grows past
+    10k regions, after arena_reset, and with large requests mixed in.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include "bench.h"
+#include "../arena.h"
+
+#define TARGET_REGIONS  12000
+#define WINDOW          2000
+#define SMALL_SIZE      48
+
+/*
+    Allocates small blocks until the allocation cursor has moved past `regions`
+    regions, reporting the cost per window of WINDOW regions. With large_every
+    set, one in every large_every requests is bigger than a default region.
+*/
+static void
+run(Arena *arena, const char *phase, size_t regions, size_t large_every)
+{
+    size_t allocs = 0, window_allocs = 0, position = 0, i, size;
+    double elapsed = 0, start;
+    Region *last = arena->curr;
+    unsigned char *p;
+
+    while(position < regions){
+        start = now_sec();
+        for(i = 0; i < 1024; ++i, ++allocs){
+            size = SMALL_SIZE;
+            if(large_every != 0 && (allocs % large_every) == 0){
+                size = (size_t)ARENA_REGION_DEFAULT_CAPACITY * 4;
+            }
+            p = arena_alloc(arena, size);
+            p[0] = 1;
+        }
+        elapsed += now_sec() - start;
+        window_allocs += 1024;
+
+        for(; last != arena->curr; last = last->next){
+            position++;
+            if(position % WINDOW == 0){
+                printf("%s,%zu,%zu,%.2f\n", phase, position, window_allocs,
+                       elapsed * 1e9 / window_allocs);
+                window_allocs = 0;
+                elapsed = 0;
+            }
+        }
+    }
+}
+
+int
+main(void)
+{
+    Arena arena = {0};
+
+    arena_init(&arena, 4096);
+
+    printf("phase,cursor_region,allocs,ns_per_alloc\n");
+    run(&arena, "grow", TARGET_REGIONS, 0);
+
+    /* Same workload again: the cursor walks over the regions emptied by the reset */
+    arena_reset(&arena);
+    run(&arena, "reuse", TARGET_REGIONS, 0);
+
+    /* Large requests get dedicated regions and must not scan or retire anything */
+    arena_reset(&arena);
+    run(&arena, "mixed", TARGET_REGIONS, 256);
+
+    arena_destroy(&arena);
+    return 0;
+}
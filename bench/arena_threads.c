@@ -0,0 +1,107 @@
+/*
+    Copyright (C) 2025  Mina Albert Saeed <mina.albert.saeed@gmail.com>
+
+    Contention benchmark: N threads allocating from one shared Arena through the
+    mutex-protected arena_alloc, the ARENA_LOCKFREE fast path, or a per-thread
+    ArenaLocal.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "bench.h"
+#include "../arena.h"
+
+#define ALLOCS_PER_THREAD  (1000 * 1000)
+
+enum { MODE_MUTEX, MODE_LOCKFREE, MODE_LOCAL, MODE_COUNT };
+
+static const char *mode_names[MODE_COUNT] = { "mutex", "lockfree", "local" };
+
+typedef struct {
+    Arena *arena;
+    int mode;
+} Worker;
+
+static void *
+worker_run(void *arg)
+{
+    Worker *w = arg;
+    ArenaLocal local;
+    unsigned char *p;
+    size_t i, size;
+
+    arena_local_init(&local, w->arena, 0);
+    for(i = 0; i < ALLOCS_PER_THREAD; ++i){
+        size = 8 + (i & 63);
+        p = w->mode == MODE_LOCAL ? arena_local_alloc(&local, size) : arena_alloc(w->arena, size);
+        p[0] = (unsigned char)i; /* touch the memory */
+    }
+    return NULL;
+}
+
+static double
+run(int nthreads, int mode)
+{
+    Arena arena = {0};
+    pthread_t threads[nthreads];
+    Worker w;
+    double start, elapsed;
+    int i;
+
+    /* Big enough for every allocation so the run measures locking, not region growth */
+    arena_init(&arena, (size_t)nthreads * ALLOCS_PER_THREAD * 80,
+               .flags = mode == MODE_LOCKFREE ? ARENA_LOCKFREE : 0);
+    w.arena = &arena;
+    w.mode = mode;
+
+    start = now_sec();
+    for(i = 0; i < nthreads; ++i){
+        pthread_create(&threads[i], NULL, worker_run, &w);
+    }
+    for(i = 0; i < nthreads; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = now_sec() - start;
+
+    arena_destroy(&arena);
+    return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+    int max_threads, n, mode;
+    double elapsed, total;
+
+    max_threads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(max_threads < 1){
+        max_threads = 1;
+    }
+
+    printf("threads,mode,seconds,ns_per_alloc,allocs_per_sec\n");
+    /* Powers of two, then max_threads itself when it is not one */
+    for(n = 1; n <= max_threads; n = (n < max_threads && n * 2 > max_threads) ? max_threads : n * 2){
+        total = (double)n * ALLOCS_PER_THREAD;
+        for(mode = 0; mode < MODE_COUNT; ++mode){
+            elapsed = run(n, mode);
+            printf("%d,%s,%.4f,%.2f,%.0f\n", n, mode_names[mode],
+                   elapsed, elapsed * 1e9 / total, total / elapsed);
+        }
+    }
+    return 0;
+}
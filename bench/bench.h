@@ -0,0 +1,120 @@
+/*
+    Copyright (C) 2025  Mina Albert Saeed <mina.albert.saeed@gmail.com>
+
+    Microbenchmark harness shared by the programs under bench/.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BENCH_LIB
+#define BENCH_LIB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_SAMPLES 31
+#define BENCH_WARMUP  3
+
+/*
+    One benchmark case. run performs ops operations on ctx and is timed as one
+    sample; setup and teardown (both optional) run around every sample, outside
+    the clock. bytes is the payload of one operation, 0 leaves bytes/s empty.
+*/
+typedef struct {
+    const char *group;
+    const char *impl;
+    void (*setup)(void *ctx);
+    void (*run)(void *ctx, size_t ops);
+    void (*teardown)(void *ctx);
+    void *ctx;
+    size_t ops;
+    size_t bytes;
+} Bench;
+
+static inline double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int
+bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static inline double
+bench_percentile(const double *sorted, size_t n, double p)
+{
+    size_t rank = (size_t)(p / 100.0 * n + 0.5);
+    if(rank == 0){
+        rank = 1;
+    }
+    return sorted[(rank > n ? n : rank) - 1];
+}
+
+static inline void
+bench_header(void)
+{
+    printf("group,impl,ops,ns_per_op,bytes_per_sec,p50_ns,p90_ns,p99_ns,min_ns\n");
+}
+
+/* Runs b BENCH_SAMPLES times and prints one CSV row, all times are per operation */
+static inline void
+bench_run(const Bench *b)
+{
+    double samples[BENCH_SAMPLES], start, sum = 0, p50;
+    size_t i;
+
+    for(i = 0; i < BENCH_WARMUP + BENCH_SAMPLES; ++i){
+        if(b->setup != NULL){
+            b->setup(b->ctx);
+        }
+        start = now_sec();
+        b->run(b->ctx, b->ops);
+        if(i >= BENCH_WARMUP){
+            samples[i - BENCH_WARMUP] = (now_sec() - start) * 1e9 / b->ops;
+        }
+        if(b->teardown != NULL){
+            b->teardown(b->ctx);
+        }
+    }
+
+    for(i = 0; i < BENCH_SAMPLES; ++i){
+        sum += samples[i];
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), bench_cmp_double);
+    p50 = bench_percentile(samples, BENCH_SAMPLES, 50);
+
+    printf("%s,%s,%zu,%.2f,", b->group, b->impl, b->ops, sum / BENCH_SAMPLES);
+    if(b->bytes != 0){
+        printf("%.0f", b->bytes * 1e9 / p50);
+    }
+    printf(",%.2f,%.2f,%.2f,%.2f\n", p50,
+           bench_percentile(samples, BENCH_SAMPLES, 90),
+           bench_percentile(samples, BENCH_SAMPLES, 99),
+           samples[0]);
+    fflush(stdout);
+}
+
+/* Keeps the compiler from dropping work whose result is unused */
+static volatile size_t bench_sink;
+
+#endif
@@ -0,0 +1,241 @@
+/*
+    Copyright (C) 2025  Mina Albert Saeed <mina.albert.saeed@gmail.com>
+
+    arena_memcpy/arena_strlen: checks every kernel level against a byte
+    loop over unaligned heads and tails, then measures them next to libc.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bench.h"
+#include "../arena.h"
+
+#define CHECK_MAX_LEN   600
+#define CHECK_OFFSETS   64
+#define GUARD           64
+#define COPY_OPS        4096
+
+static const char *level_names[] = { "auto", "word", "sse2", "avx2" };
+
+typedef struct {
+    unsigned char *src;
+    unsigned char *dst;
+    size_t size;
+} Ctx;
+
+static int
+check_memcpy(void)
+{
+    static unsigned char src[CHECK_OFFSETS + CHECK_MAX_LEN + GUARD];
+    static unsigned char dst[CHECK_OFFSETS + CHECK_MAX_LEN + 2 * GUARD];
+    size_t so, doff, n, i;
+    unsigned char *end;
+
+    for(i = 0; i < sizeof(src); ++i){
+        src[i] = (unsigned char)(i * 7 + 1);
+    }
+    for(so = 0; so < CHECK_OFFSETS; ++so){
+        for(doff = 0; doff < CHECK_OFFSETS; doff += 7){
+            for(n = 0; n <= CHECK_MAX_LEN; ++n){
+                memset(dst, 0xEE, sizeof(dst));
+                end = arena_memcpy(dst + GUARD + doff, src + so, n);
+                if(end != dst + GUARD + doff + n){
+                    printf("memcpy: bad return, src+%zu dst+%zu n=%zu\n", so, doff, n);
+                    return -1;
+                }
+                for(i = 0; i < sizeof(dst); ++i){
+                    if(i >= GUARD + doff && i < GUARD + doff + n){
+                        if(dst[i] != src[so + i - GUARD - doff]){
+                            printf("memcpy: byte %zu wrong, src+%zu dst+%zu n=%zu\n", i, so, doff, n);
+                            return -1;
+                        }
+                    } else if(dst[i] != 0xEE){
+                        printf("memcpy: wrote outside, src+%zu dst+%zu n=%zu\n", so, doff, n);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* Strings ending right before an unmapped page catch kernels that read too far */
+static int
+check_strlen(void)
+{
+    size_t page = sysconf(_SC_PAGESIZE), off, n;
+    unsigned char *map, *s;
+
+    map = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(map == MAP_FAILED || mprotect(map + page, page, PROT_NONE) != 0){
+        perror("mmap");
+        return -1;
+    }
+    memset(map, 'x', page);
+
+    for(n = 0; n <= CHECK_MAX_LEN; ++n){
+        /* Terminator on the last byte of the page, every head alignment */
+        s = map + page - 1 - n;
+        *(map + page - 1) = '\0';
+        if(arena_strlen((char*)s) != n){
+            printf("strlen: page end, n=%zu\n", n);
+            return -1;
+        }
+        /* Terminator at every position of a string with a shifted head */
+        for(off = 0; off < CHECK_OFFSETS; ++off){
+            s = map + off;
+            s[n] = '\0';
+            if(arena_strlen((char*)s) != n){
+                printf("strlen: head +%zu, n=%zu\n", off, n);
+                return -1;
+            }
+            s[n] = 'x';
+        }
+    }
+    munmap(map, 2 * page);
+    return 0;
+}
+
+static void
+run_arena_memcpy(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        arena_memcpy(c->dst + 1, c->src + 3, c->size);
+    }
+}
+
+static void
+run_byte_copy(void *p, size_t ops)
+{
+    Ctx *c = p;
+    volatile unsigned char *d;
+    size_t i, j;
+
+    for(i = 0; i < ops; ++i){
+        d = c->dst + 1;
+        for(j = 0; j < c->size; ++j){
+            d[j] = c->src[3 + j];
+        }
+    }
+}
+
+static void
+run_memcpy(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        memcpy(c->dst + 1, c->src + 3, c->size);
+        bench_sink += c->dst[1];
+    }
+}
+
+static void
+run_arena_strlen(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += arena_strlen((char*)c->src + 3);
+    }
+}
+
+static void
+run_strlen(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += strlen((char*)c->src + 3);
+    }
+}
+
+int
+main(void)
+{
+    static const size_t sizes[] = { 16, 100, 1024, 4096, 65536 };
+    char impl[64];
+    Ctx ctx;
+    Bench b;
+    size_t i;
+    int level, max_level, failed = 0;
+
+    max_level = arena_simd_select(ARENA_SIMD_AUTO);
+    for(level = ARENA_SIMD_WORD; level <= max_level; ++level){
+        arena_simd_select(level);
+        if(check_memcpy() != 0 || check_strlen() != 0){
+            printf("%s kernels FAILED\n", level_names[level]);
+            failed = 1;
+        }
+    }
+    if(failed){
+        return 1;
+    }
+    fprintf(stderr, "kernels word..%s: ok\n", level_names[max_level]);
+
+    ctx.src = malloc(65536 + 64);
+    ctx.dst = malloc(65536 + 64);
+    memset(ctx.src, 'a', 65536 + 64);
+
+    bench_header();
+    for(i = 0; i < ARENA_SIZE_ARR(sizes); ++i){
+        ctx.size = sizes[i];
+        ctx.src[3 + ctx.size] = '\0';
+
+        b = (Bench){ "memcpy", NULL, NULL, NULL, NULL, &ctx, COPY_OPS, ctx.size };
+        for(level = ARENA_SIMD_WORD; level <= max_level; ++level){
+            arena_simd_select(level);
+            snprintf(impl, sizeof(impl), "arena_memcpy(%s)/%zu", level_names[level], ctx.size);
+            b.impl = impl;
+            b.run = run_arena_memcpy;
+            bench_run(&b);
+        }
+        snprintf(impl, sizeof(impl), "byte loop/%zu", ctx.size);
+        b.run = run_byte_copy;
+        bench_run(&b);
+        snprintf(impl, sizeof(impl), "memcpy/%zu", ctx.size);
+        b.run = run_memcpy;
+        bench_run(&b);
+
+        b.group = "strlen";
+        for(level = ARENA_SIMD_WORD; level <= max_level; ++level){
+            arena_simd_select(level);
+            snprintf(impl, sizeof(impl), "arena_strlen(%s)/%zu", level_names[level], ctx.size);
+            b.run = run_arena_strlen;
+            bench_run(&b);
+        }
+        snprintf(impl, sizeof(impl), "strlen/%zu", ctx.size);
+        b.run = run_strlen;
+        bench_run(&b);
+
+        ctx.src[3 + ctx.size] = 'a';
+    }
+
+    free(ctx.src);
+    free(ctx.dst);
+    return 0;
+}
@@ -0,0 +1,1057 @@
+/*
+    Copyright (C) 2025  Mina Albert Saeed <mina.albert.saeed@gmail.com>
+
+    Throughput suite: the arena and string operations next to the libc
+    calls they replace. Prints one CSV row per case, see bench.h.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#define _GNU_SOURCE /* memmem */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "../string.h"
+
+#define ALLOC_OPS       100000
+#define APPEND_OPS      4096
+#define APPEND_TOKEN    "token "
+#define HAYSTACK_SIZE   (64 * 1024)
+#define NEEDLE_SHORT    16
+#define NEEDLE_LONG     256
+#define NEEDLE_PERIODIC 4096  /* "aa...ab" in a haystack of 'a', the worst case of naive search */
+#define FIND_OPS        256
+#define FILE_SIZE       (16 * 1024 * 1024)
+#define REPLACE_TEXT    (8 * 1024)
+#define KEYWORDS        500
+#define KEYWORD_TEXT    (16 * 1024)
+#define FIELD           "  field  value  "
+#define FIELDS          4096
+#define CSV_ROW         "2025-01-01,GET,/index.html,200,1532,0.004;mozilla\n"
+#define CSV_TEXT        (64 * 1024)
+#define KEYS            10000
+#define KEY_SHORT       "user:4711:name"                     /* inline */
+#define TABLE_KEYS      100000
+#define DOC_SIZE        (128 * 1024)
+#define DOC_INSERTS     4096
+#define DOC_VALUE       "<b>value</b>"
+#define KEY_LONG        "user:4711:preferences:notifications" /* heap or arena */
+
+typedef struct {
+    Arena arena;
+    Arena lockfree;
+    ArenaLocal local;
+    String string;
+    String field;
+    StrViews views;
+    String *keys;
+    char **key_ptrs;
+    const char *key;
+    const char *snapshot;
+    StrGap gap;
+    void *ptrs[ALLOC_OPS];
+    char *buf;
+    size_t needle_size;
+    StrSearcher searcher;
+    StrSearcher keyword_searchers[KEYWORDS];
+    StrMatcher *matcher;
+    const char *path;
+} Ctx;
+
+static Ctx ctx;
+
+/* Mixed small sizes, 16 to 271 bytes */
+#define ALLOC_SIZE(i) (16 + ((i) * 37) % 256)
+
+static void
+arena_teardown(void *p)
+{
+    arena_reset(&((Ctx*)p)->arena);
+}
+
+static void
+run_arena_alloc(void *p, size_t ops)
+{
+    Ctx *c = p;
+    unsigned char *ptr;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        ptr = arena_alloc(&c->arena, ALLOC_SIZE(i));
+        ptr[0] = (unsigned char)i;
+    }
+}
+
+static void
+lockfree_teardown(void *p)
+{
+    arena_reset(&((Ctx*)p)->lockfree);
+}
+
+static void
+run_arena_alloc_lockfree(void *p, size_t ops)
+{
+    Ctx *c = p;
+    unsigned char *ptr;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        ptr = arena_alloc(&c->lockfree, ALLOC_SIZE(i));
+        ptr[0] = (unsigned char)i;
+    }
+}
+
+static void
+run_arena_local_alloc(void *p, size_t ops)
+{
+    Ctx *c = p;
+    unsigned char *ptr;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        ptr = arena_local_alloc(&c->local, ALLOC_SIZE(i));
+        ptr[0] = (unsigned char)i;
+    }
+}
+
+static void
+run_malloc(void *p, size_t ops)
+{
+    Ctx *c = p;
+    unsigned char *ptr;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        ptr = malloc(ALLOC_SIZE(i));
+        ptr[0] = (unsigned char)i;
+        c->ptrs[i] = ptr;
+    }
+}
+
+static void
+malloc_teardown(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ALLOC_OPS; ++i){
+        free(c->ptrs[i]);
+    }
+}
+
+static void
+string_setup(void *p)
+{
+    Ctx *c = p;
+    c->string = (String){0};
+}
+
+static void
+run_str_append_arena(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_append_cstr(&c->string, APPEND_TOKEN, .arena = &c->arena);
+    }
+}
+
+static void
+run_str_append_heap(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_append_cstr(&c->string, APPEND_TOKEN);
+    }
+}
+
+static void
+string_free_teardown(void *p)
+{
+    str_free(&((Ctx*)p)->string);
+}
+
+static void
+strcat_setup(void *p)
+{
+    ((Ctx*)p)->buf[0] = '\0';
+}
+
+static void
+run_strcat(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        strcat(c->buf, APPEND_TOKEN);
+    }
+}
+
+static void
+run_str_find_cstr(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += str_find_cstr(&c->string, c->buf);
+    }
+}
+
+static void
+run_str_searcher_find(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += str_searcher_find(&c->searcher, &c->string);
+    }
+}
+
+static void
+run_str_searcher_count(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += str_searcher_count(&c->searcher, &c->string);
+    }
+}
+
+static void
+run_memmem(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += (char*)memmem(str_data(&c->string), c->string.size, c->buf, c->needle_size) - str_data(&c->string);
+    }
+}
+
+static void
+run_strstr(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += strstr(str_data(&c->string), c->buf) - str_data(&c->string);
+    }
+}
+
+static void
+run_str_from_file_arena(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        string_setup(c);
+        str_from_file(&c->string, c->path, .arena = &c->arena);
+        bench_sink += c->string.size;
+    }
+}
+
+static void
+run_str_from_file_heap(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        string_setup(c);
+        str_from_file(&c->string, c->path);
+        bench_sink += c->string.size;
+        str_free(&c->string);
+    }
+}
+
+/* Mapping alone touches nothing, so every page is read once like the copies do */
+static void
+run_str_file_map(void *p, size_t ops)
+{
+    Ctx *c = p;
+    StrFileMap map;
+    size_t i, off;
+
+    for(i = 0; i < ops; ++i){
+        str_file_map(&map, c->path);
+        for(off = 0; off < map.view.len; off += 4096){
+            bench_sink += (size_t)map.view.ptr[off];
+        }
+        str_file_unmap(&map);
+    }
+}
+
+static void
+run_str_reader(void *p, size_t ops)
+{
+    Ctx *c = p;
+    StrReader reader;
+    StringView line;
+    size_t i;
+    int fd;
+
+    for(i = 0; i < ops; ++i){
+        fd = open(c->path, O_RDONLY);
+        str_reader_init(&reader, fd, 0);
+        while(str_reader_next(&reader, &line) > 0){
+            bench_sink += line.len;
+        }
+        str_reader_free(&reader);
+        close(fd);
+    }
+}
+
+static void
+run_getline(void *p, size_t ops)
+{
+    Ctx *c = p;
+    char *line = NULL;
+    size_t i, cap = 0;
+    ssize_t len;
+    FILE *f;
+
+    for(i = 0; i < ops; ++i){
+        f = fopen(c->path, "r");
+        while((len = getline(&line, &cap, f)) > 0){
+            bench_sink += len;
+        }
+        fclose(f);
+    }
+    free(line);
+}
+
+static void
+run_read(void *p, size_t ops)
+{
+    Ctx *c = p;
+    struct stat st;
+    ssize_t n;
+    size_t i, off;
+    char *buf;
+    int fd;
+
+    for(i = 0; i < ops; ++i){
+        fd = open(c->path, O_RDONLY);
+        fstat(fd, &st);
+        buf = malloc(st.st_size + 1);
+        for(off = 0; (n = read(fd, buf + off, st.st_size - off)) > 0; off += n);
+        buf[off] = '\0';
+        close(fd);
+        bench_sink += off;
+        free(buf);
+    }
+}
+
+/* Haystack of pseudo-random lowercase letters, the needle is its tail */
+static void
+make_haystack(Ctx *c, size_t needle_size)
+{
+    char *text;
+    size_t i;
+    unsigned x = 12345;
+
+    text = malloc(HAYSTACK_SIZE);
+    for(i = 0; i < HAYSTACK_SIZE; ++i){
+        x = x * 1103515245u + 12345u;
+        text[i] = 'a' + (x >> 16) % 26;
+    }
+    string_setup(c);
+    str_append_cstr_n(&c->string, text, HAYSTACK_SIZE);
+    free(text);
+
+    c->needle_size = needle_size;
+    c->buf = malloc(needle_size + 1);
+    memcpy(c->buf, str_data(&c->string) + HAYSTACK_SIZE - needle_size, needle_size + 1);
+    str_searcher_init(&c->searcher, c->buf, needle_size);
+}
+
+static void
+bench_find(Ctx *c, size_t needle_size)
+{
+    char impl[64];
+    Bench b;
+
+    make_haystack(c, needle_size);
+    b = (Bench){ "find", impl, NULL, NULL, NULL, c, FIND_OPS, HAYSTACK_SIZE };
+
+    snprintf(impl, sizeof(impl), "str_find_cstr/%zu", needle_size);
+    b.run = run_str_find_cstr;
+    bench_run(&b);
+    snprintf(impl, sizeof(impl), "str_searcher_find/%zu", needle_size);
+    b.run = run_str_searcher_find;
+    bench_run(&b);
+    snprintf(impl, sizeof(impl), "str_searcher_count/%zu", needle_size);
+    b.run = run_str_searcher_count;
+    bench_run(&b);
+    snprintf(impl, sizeof(impl), "memmem/%zu", needle_size);
+    b.run = run_memmem;
+    bench_run(&b);
+    snprintf(impl, sizeof(impl), "strstr/%zu", needle_size);
+    b.run = run_strstr;
+    bench_run(&b);
+
+    str_free(&c->string);
+    free(c->buf);
+}
+
+static void
+bench_find_periodic(Ctx *c)
+{
+    char impl[64], *text;
+    Bench b;
+
+    text = malloc(HAYSTACK_SIZE);
+    memset(text, 'a', HAYSTACK_SIZE);
+    string_setup(c);
+    str_append_cstr_n(&c->string, text, HAYSTACK_SIZE);
+    free(text);
+
+    c->needle_size = NEEDLE_PERIODIC;
+    c->buf = malloc(NEEDLE_PERIODIC + 1);
+    memset(c->buf, 'a', NEEDLE_PERIODIC - 1);
+    c->buf[NEEDLE_PERIODIC - 1] = 'b';
+    c->buf[NEEDLE_PERIODIC] = '\0';
+    str_searcher_init(&c->searcher, c->buf, NEEDLE_PERIODIC);
+
+    b = (Bench){ "find", impl, NULL, NULL, NULL, c, FIND_OPS / 16, HAYSTACK_SIZE };
+    snprintf(impl, sizeof(impl), "str_searcher_find/periodic%d", NEEDLE_PERIODIC);
+    b.run = run_str_searcher_find;
+    bench_run(&b);
+    snprintf(impl, sizeof(impl), "memmem/periodic%d", NEEDLE_PERIODIC);
+    b.run = run_memmem;
+    bench_run(&b);
+
+    str_free(&c->string);
+    free(c->buf);
+}
+
+static void
+run_str_matcher_scan(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += str_matcher_scan(c->matcher, &c->string, NULL, NULL);
+    }
+}
+
+/* What the matcher replaces: one search per keyword, first occurrence only */
+static void
+run_keyword_searchers(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i, k;
+
+    for(i = 0; i < ops; ++i){
+        for(k = 0; k < KEYWORDS; ++k){
+            bench_sink += str_searcher_find(&c->keyword_searchers[k], &c->string);
+        }
+    }
+}
+
+/* KEYWORDS random 4 to 11 letter words, and a text of words some of which are keywords */
+static void
+bench_multi(Ctx *c)
+{
+    static char words[KEYWORDS][12];
+    const char *patterns[KEYWORDS];
+    char *text;
+    size_t i, j, len, pos = 0;
+    unsigned x = 777;
+    Bench b;
+
+    for(i = 0; i < KEYWORDS; ++i){
+        x = x * 1103515245u + 12345u;
+        len = 4 + (x >> 16) % 8;
+        for(j = 0; j < len; ++j){
+            x = x * 1103515245u + 12345u;
+            words[i][j] = 'a' + (x >> 16) % 26;
+        }
+        words[i][len] = '\0';
+        patterns[i] = words[i];
+        str_searcher_init(&c->keyword_searchers[i], words[i], len);
+    }
+    c->matcher = str_matcher_build(&c->arena, patterns, KEYWORDS);
+
+    text = malloc(KEYWORD_TEXT + 16);
+    while(pos < KEYWORD_TEXT){
+        x = x * 1103515245u + 12345u;
+        if((x >> 16) % 16 == 0){
+            len = strlen(words[(x >> 8) % KEYWORDS]);
+            memcpy(text + pos, words[(x >> 8) % KEYWORDS], len);
+        } else{
+            len = 2 + (x >> 16) % 9;
+            for(j = 0; j < len; ++j){
+                text[pos + j] = 'a' + (x >> (j + 4)) % 26;
+            }
+        }
+        pos += len;
+        text[pos++] = ' ';
+    }
+    string_setup(c);
+    str_append_cstr_n(&c->string, text, pos);
+    free(text);
+
+    b = (Bench){ "multi", "str_matcher_scan", NULL, run_str_matcher_scan, NULL, c, 16, pos };
+    bench_run(&b);
+    b = (Bench){ "multi", "str_searcher_find x500", NULL, run_keyword_searchers, NULL, c, 16, pos };
+    bench_run(&b);
+
+    str_free(&c->string);
+    arena_reset(&c->arena);
+}
+
+static void
+replace_setup(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    string_setup(c);
+    for(i = 0; i + 8 <= REPLACE_TEXT; i += 8){
+        str_append_cstr(&c->string, "foo bar ", .arena = &c->arena);
+    }
+}
+
+static void
+run_str_replace_all(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_replace_all_cstr(&c->string, &c->string, "bar", "bazz", .arena = &c->arena);
+    }
+}
+
+/* The loop str_replace_all replaces: find from zero, remove, insert */
+static void
+run_find_remove_insert(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+    int pos;
+
+    for(i = 0; i < ops; ++i){
+        while((pos = str_find_cstr(&c->string, "bar")) >= 0){
+            str_remove_cstr(&c->string, "bar");
+            str_insert_cstr_at(&c->string, "bazz", pos, .arena = &c->arena);
+        }
+    }
+}
+
+static void
+fields_setup(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    string_setup(c);
+    for(i = 0; i < FIELDS; ++i){
+        str_append_cstr(&c->string, FIELD, .arena = &c->arena);
+    }
+    c->field = (String){0};
+}
+
+/* Slices every field of the line and trims it, views only */
+static void
+run_sv_fields(void *p, size_t ops)
+{
+    Ctx *c = p;
+    StringView line = sv_from_str(&c->string), field;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        field = sv_trim(sv_substr(line, i * (sizeof(FIELD) - 1), sizeof(FIELD) - 1));
+        bench_sink += field.len;
+    }
+}
+
+/* The same through str_substr and str_trim, one copy per field */
+static void
+run_str_fields(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_substr(&c->field, &c->string, i * (sizeof(FIELD) - 1), sizeof(FIELD) - 1, .arena = &c->arena);
+        str_trim(&c->field);
+        bench_sink += c->field.size;
+    }
+}
+
+static void
+csv_setup(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    string_setup(c);
+    for(i = 0; i + sizeof(CSV_ROW) - 1 <= CSV_TEXT; i += sizeof(CSV_ROW) - 1){
+        str_append_cstr(&c->string, CSV_ROW, .arena = &c->arena);
+    }
+    c->views = (StrViews){0};
+}
+
+static void
+run_str_split(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        c->views.size = 0;
+        bench_sink += str_split(&c->arena, &c->views, &c->string, ',');
+    }
+}
+
+static void
+run_split_set(void *p, size_t ops)
+{
+    Ctx *c = p;
+    StrSplitIter it;
+    StringView field;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_split_init_set(&it, sv_from_str(&c->string), ",;\n", 0);
+        while(str_split_next(&it, &field)){
+            bench_sink += field.len;
+        }
+    }
+}
+
+static void
+run_split_str(void *p, size_t ops)
+{
+    Ctx *c = p;
+    StrSplitIter it;
+    StringView field;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_split_init_str(&it, sv_from_str(&c->string), "200,", 0);
+        while(str_split_next(&it, &field)){
+            bench_sink += field.len;
+        }
+    }
+}
+
+/* strtok has to write into its input, so it works on a copy */
+static void
+run_strtok(void *p, size_t ops)
+{
+    Ctx *c = p;
+    char *save, *tok;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        memcpy(c->buf, str_data(&c->string), c->string.size + 1);
+        for(tok = strtok_r(c->buf, ",;\n", &save); tok != NULL; tok = strtok_r(NULL, ",;\n", &save)){
+            bench_sink += (size_t)tok[0];
+        }
+    }
+}
+
+static void
+keys_setup(void *p)
+{
+    Ctx *c = p;
+    memset(c->keys, 0, KEYS * sizeof(String));
+}
+
+static void
+run_keys_heap(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_set_cstr(&c->keys[i], c->key);
+    }
+    for(i = 0; i < ops; ++i){
+        bench_sink += (size_t)str_data(&c->keys[i])[0];
+    }
+}
+
+static void
+keys_heap_teardown(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < KEYS; ++i){
+        str_free(&c->keys[i]);
+    }
+}
+
+static void
+run_keys_arena(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        str_set_cstr(&c->keys[i], c->key, .arena = &c->arena);
+    }
+    for(i = 0; i < ops; ++i){
+        bench_sink += (size_t)str_data(&c->keys[i])[0];
+    }
+}
+
+/* What every String cost before the inline buffer: one heap block per key */
+static void
+run_keys_malloc(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i, len = strlen(c->key);
+
+    for(i = 0; i < ops; ++i){
+        c->key_ptrs[i] = malloc(len + 1);
+        memcpy(c->key_ptrs[i], c->key, len + 1);
+    }
+    for(i = 0; i < ops; ++i){
+        bench_sink += (size_t)c->key_ptrs[i][0];
+    }
+}
+
+static void
+keys_malloc_teardown(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < KEYS; ++i){
+        free(c->key_ptrs[i]);
+    }
+}
+
+/* Bytes per key: the String itself plus what it took from the arena */
+static void
+keys_memory(Ctx *c, const char *key)
+{
+    ArenaStats stats;
+
+    c->key = key;
+    keys_setup(c);
+    run_keys_arena(c, KEYS);
+    arena_stats(&c->arena, &stats);
+    fprintf(stderr, "keys: %zu byte key, %zu bytes per String (%zu struct + %zu arena)\n",
+            strlen(key), sizeof(String) + stats.used_bytes / KEYS, sizeof(String), stats.used_bytes / KEYS);
+    arena_reset(&c->arena);
+}
+
+static void
+doc_string_setup(void *p)
+{
+    Ctx *c = p;
+    size_t i;
+
+    string_setup(c);
+    for(i = 0; i < DOC_SIZE / 64; ++i){
+        str_append_cstr(&c->string, "lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do ", .arena = &c->arena);
+    }
+}
+
+static void
+doc_gap_setup(void *p)
+{
+    Ctx *c = p;
+
+    doc_string_setup(c);
+    c->gap = (StrGap){0};
+    str_gap_append_sv(&c->gap, sv_from_str(&c->string), .arena = &c->arena);
+}
+
+/* Placeholders expanded front to back, each insert lands after the previous one */
+static void
+run_doc_string(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i, pos = 0;
+
+    for(i = 0; i < ops; ++i){
+        pos += DOC_SIZE / DOC_INSERTS;
+        str_insert_cstr_at(&c->string, DOC_VALUE, pos, .arena = &c->arena);
+        pos += sizeof(DOC_VALUE) - 1;
+    }
+}
+
+static void
+run_doc_gap(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i, pos = 0;
+
+    for(i = 0; i < ops; ++i){
+        pos += DOC_SIZE / DOC_INSERTS;
+        str_gap_insert_cstr(&c->gap, pos, DOC_VALUE, .arena = &c->arena);
+        pos += sizeof(DOC_VALUE) - 1;
+    }
+    str_gap_flatten(&c->string, &c->gap, .arena = &c->arena);
+}
+
+typedef struct {
+    size_t count;
+    String *keys;
+} Table;
+
+static Table *
+table_build(Arena *arena)
+{
+    Table *table;
+    char key[32];
+    size_t i;
+
+    table = arena_alloc(arena, sizeof(*table));
+    table->count = TABLE_KEYS;
+    table->keys = arena_alloc(arena, TABLE_KEYS * sizeof(String));
+    for(i = 0; i < TABLE_KEYS; ++i){
+        snprintf(key, sizeof(key), "user:%zu:session", i * 7919);
+        table->keys[i] = (String){0};
+        str_set_cstr(&table->keys[i], key, .arena = arena);
+    }
+    return table;
+}
+
+/* Startup without a snapshot: every key is formatted and copied again */
+static void
+run_table_rebuild(void *p, size_t ops)
+{
+    Ctx *c = p;
+    size_t i;
+
+    for(i = 0; i < ops; ++i){
+        bench_sink += table_build(&c->arena)->keys[TABLE_KEYS - 1].size;
+    }
+}
+
+static void
+run_table_reopen(void *p, size_t ops)
+{
+    Ctx *c = p;
+    Arena arena;
+    Table *table;
+    size_t i;
+    int rc;
+
+    for(i = 0; i < ops; ++i){
+        rc = arena_open_file(&arena, c->snapshot);
+        if(rc != 1){
+            fprintf(stderr, "arena_open_file %s failed\n", c->snapshot);
+            if(rc == 0){
+                arena_destroy(&arena);
+            }
+            return;
+        }
+        table = arena_root(&arena);
+        bench_sink += table->keys[TABLE_KEYS - 1].size;
+        arena_destroy(&arena);
+    }
+}
+
+static int
+make_snapshot(char *path)
+{
+    Arena arena;
+    int fd;
+
+    fd = mkstemp(path);
+    if(fd < 0){
+        perror("mkstemp");
+        return -1;
+    }
+    close(fd);
+    if(arena_open_file(&arena, path) != 0){
+        fprintf(stderr, "arena_open_file %s failed\n", path);
+        unlink(path);
+        return -1;
+    }
+    arena_set_root(&arena, table_build(&arena));
+    arena_sync(&arena);
+    arena_destroy(&arena);
+    return 0;
+}
+
+static int
+make_file(char *path)
+{
+    char block[4096];
+    size_t i;
+    int fd;
+
+    fd = mkstemp(path);
+    if(fd < 0){
+        perror("mkstemp");
+        return -1;
+    }
+    for(i = 0; i < sizeof(block); ++i){
+        block[i] = (i % 64) == 63 ? '\n' : 'a' + i % 26;
+    }
+    for(i = 0; i < FILE_SIZE / sizeof(block); ++i){
+        if(write(fd, block, sizeof(block)) != (ssize_t)sizeof(block)){
+            perror("write");
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+int
+main(void)
+{
+    char path[] = "/tmp/bench_suiteXXXXXX";
+    char snapshot[] = "/tmp/bench_snapshotXXXXXX";
+    Bench b;
+
+    arena_init(&ctx.arena, 0);
+    arena_init(&ctx.lockfree, 0, .flags = ARENA_LOCKFREE);
+    arena_local_init(&ctx.local, &ctx.lockfree, 0);
+    bench_header();
+
+    b = (Bench){ "alloc", "arena_alloc", NULL, run_arena_alloc, arena_teardown, &ctx, ALLOC_OPS, 0 };
+    bench_run(&b);
+    b = (Bench){ "alloc", "arena_alloc(lockfree)", NULL, run_arena_alloc_lockfree, lockfree_teardown,
+                 &ctx, ALLOC_OPS, 0 };
+    bench_run(&b);
+    b = (Bench){ "alloc", "arena_local_alloc", NULL, run_arena_local_alloc, lockfree_teardown,
+                 &ctx, ALLOC_OPS, 0 };
+    bench_run(&b);
+    b = (Bench){ "alloc", "malloc", NULL, run_malloc, malloc_teardown, &ctx, ALLOC_OPS, 0 };
+    bench_run(&b);
+
+    b = (Bench){ "append", "str_append_cstr(arena)", string_setup, run_str_append_arena, arena_teardown,
+                 &ctx, APPEND_OPS, sizeof(APPEND_TOKEN) - 1 };
+    bench_run(&b);
+    b = (Bench){ "append", "str_append_cstr(heap)", string_setup, run_str_append_heap, string_free_teardown,
+                 &ctx, APPEND_OPS, sizeof(APPEND_TOKEN) - 1 };
+    bench_run(&b);
+    ctx.buf = malloc(APPEND_OPS * (sizeof(APPEND_TOKEN) - 1) + 1);
+    b = (Bench){ "append", "strcat", strcat_setup, run_strcat, NULL, &ctx, APPEND_OPS, sizeof(APPEND_TOKEN) - 1 };
+    bench_run(&b);
+    free(ctx.buf);
+
+    bench_find(&ctx, NEEDLE_SHORT);
+    bench_find(&ctx, NEEDLE_LONG);
+    bench_find_periodic(&ctx);
+    bench_multi(&ctx);
+
+    b = (Bench){ "replace", "str_replace_all", replace_setup, run_str_replace_all, arena_teardown,
+                 &ctx, 1, REPLACE_TEXT };
+    bench_run(&b);
+    b = (Bench){ "replace", "find+remove+insert", replace_setup, run_find_remove_insert, arena_teardown,
+                 &ctx, 1, REPLACE_TEXT };
+    bench_run(&b);
+
+    b = (Bench){ "substr", "sv_substr+sv_trim", fields_setup, run_sv_fields, arena_teardown,
+                 &ctx, FIELDS, sizeof(FIELD) - 1 };
+    bench_run(&b);
+    b = (Bench){ "substr", "str_substr+str_trim", fields_setup, run_str_fields, arena_teardown,
+                 &ctx, FIELDS, sizeof(FIELD) - 1 };
+    bench_run(&b);
+
+    ctx.buf = malloc(CSV_TEXT + 1);
+    b = (Bench){ "split", "str_split/byte", csv_setup, run_str_split, arena_teardown, &ctx, 1, CSV_TEXT };
+    bench_run(&b);
+    b = (Bench){ "split", "str_split_init_set/3", csv_setup, run_split_set, arena_teardown,
+                 &ctx, 1, CSV_TEXT };
+    bench_run(&b);
+    b = (Bench){ "split", "str_split_init_str", csv_setup, run_split_str, arena_teardown,
+                 &ctx, 1, CSV_TEXT };
+    bench_run(&b);
+    b = (Bench){ "split", "strtok_r/3", csv_setup, run_strtok, arena_teardown, &ctx, 1, CSV_TEXT };
+    bench_run(&b);
+    free(ctx.buf);
+
+    ctx.keys = malloc(KEYS * sizeof(String));
+    ctx.key_ptrs = malloc(KEYS * sizeof(char*));
+    ctx.key = KEY_SHORT;
+    b = (Bench){ "keys", "str_set_cstr(heap)/short", keys_setup, run_keys_heap, keys_heap_teardown,
+                 &ctx, KEYS, sizeof(KEY_SHORT) - 1 };
+    bench_run(&b);
+    b = (Bench){ "keys", "str_set_cstr(arena)/short", keys_setup, run_keys_arena, arena_teardown,
+                 &ctx, KEYS, sizeof(KEY_SHORT) - 1 };
+    bench_run(&b);
+    b = (Bench){ "keys", "malloc+memcpy/short", NULL, run_keys_malloc, keys_malloc_teardown,
+                 &ctx, KEYS, sizeof(KEY_SHORT) - 1 };
+    bench_run(&b);
+    ctx.key = KEY_LONG;
+    b = (Bench){ "keys", "str_set_cstr(heap)/long", keys_setup, run_keys_heap, keys_heap_teardown,
+                 &ctx, KEYS, sizeof(KEY_LONG) - 1 };
+    bench_run(&b);
+    b = (Bench){ "keys", "str_set_cstr(arena)/long", keys_setup, run_keys_arena, arena_teardown,
+                 &ctx, KEYS, sizeof(KEY_LONG) - 1 };
+    bench_run(&b);
+    keys_memory(&ctx, KEY_SHORT);
+    keys_memory(&ctx, KEY_LONG);
+    free(ctx.keys);
+    free(ctx.key_ptrs);
+
+    b = (Bench){ "insert", "str_insert_cstr_at", doc_string_setup, run_doc_string, arena_teardown,
+                 &ctx, DOC_INSERTS, sizeof(DOC_VALUE) - 1 };
+    bench_run(&b);
+    b = (Bench){ "insert", "str_gap_insert_cstr+flatten", doc_gap_setup, run_doc_gap, arena_teardown,
+                 &ctx, DOC_INSERTS, sizeof(DOC_VALUE) - 1 };
+    bench_run(&b);
+
+    if(make_snapshot(snapshot) == 0){
+        ctx.snapshot = snapshot;
+        b = (Bench){ "snapshot", "rebuild", NULL, run_table_rebuild, arena_teardown, &ctx, 1, 0 };
+        bench_run(&b);
+        b = (Bench){ "snapshot", "arena_open_file", NULL, run_table_reopen, NULL, &ctx, 1, 0 };
+        bench_run(&b);
+        unlink(snapshot);
+    }
+
+    if(make_file(path) == 0){
+        ctx.path = path;
+        b = (Bench){ "from_file", "str_from_file(arena)", NULL, run_str_from_file_arena, arena_teardown,
+                     &ctx, 1, FILE_SIZE };
+        bench_run(&b);
+        b = (Bench){ "from_file", "str_from_file(heap)", NULL, run_str_from_file_heap, NULL,
+                     &ctx, 1, FILE_SIZE };
+        bench_run(&b);
+        b = (Bench){ "from_file", "str_file_map", NULL, run_str_file_map, NULL, &ctx, 1, FILE_SIZE };
+        bench_run(&b);
+        b = (Bench){ "from_file", "read", NULL, run_read, NULL, &ctx, 1, FILE_SIZE };
+        bench_run(&b);
+        b = (Bench){ "lines", "str_reader_next", NULL, run_str_reader, NULL, &ctx, 1, FILE_SIZE };
+        bench_run(&b);
+        b = (Bench){ "lines", "getline", NULL, run_getline, NULL, &ctx, 1, FILE_SIZE };
+        bench_run(&b);
+        unlink(path);
+    }
+
+    arena_destroy(&ctx.lockfree);
+    arena_destroy(&ctx.arena);
+    return 0;
+}
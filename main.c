@@ -4,8 +4,8 @@
 
 #define debug_string(str) {  \
     printf("size: %4zu\n", (str)->size);\
-    printf("Capacity: %0zu\n", (str)->capacity);\
-    printf("Address: %5p\n", (str)->arr);\
+    printf("Capacity: %0zu\n", STR_CAPACITY(*(str)));\
+    printf("Address: %5p\n", str_data(str));\
 } \
 
 int
@@ -26,14 +26,17 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "string.h"
 
-#define debug_string(str) {  \
-    printf("size: %4zu\n", (str)->size);\
-    printf("Capacity: %0zu\n", (str)->capacity);\
-    printf("Address: %5p\n", (str)->arr);\
-} \
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STR_X86
+#endif
 
+#define STR_NPOS ((size_t)-1)
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MUST(condition, message) \
@@ -47,9 +50,7 @@
 size_t
 _strlen(const char *str)
 {
-    const char *s;
-    for (s = str; *s; ++s);
-    return (s - str);
+    return arena_strlen(str);
 }
 
 static size_t
@@ -70,44 +71,60 @@ nearest_pow(size_t num)
 }
 
 static void *
-_realloc(void *ptr, size_t oldsize, size_t newsize, Arena *arena)
+_realloc(void *ptr, size_t oldsize, size_t newsize, Args args)
 {
-    if (arena != NULL){
-        return arena_realloc(arena, ptr, oldsize, newsize);
+    if (args.arena != NULL){
+        return arena_realloc_tagged(args.arena, ptr, oldsize, newsize, args.tag);
     }
     else {
         return realloc(ptr, newsize);
     }
 }
 
+static void *_alloc(size_t size, Args args);
+
 static void 
-str_realloc(String *string, size_t size, Arena *arena)
+str_realloc(String *string, size_t size, Args args)
 {
+    char *arr;
     MUST(string != NULL, "string is NULL in str_realloc");
-    string->arr = _realloc(string->arr, string->capacity, size, arena);
+
+    if(!STR_IS_INLINE(*string)){
+        string->buf.heap.arr = _realloc(string->buf.heap.arr, string->buf.heap.capacity, size, args);
+        return;
+    }
+
+    /* Leaving the inline buffer, the contents move with their terminator */
+    arr = _alloc(size, args);
+    if(arr != NULL){
+        memcpy(arr, string->buf.sso, MIN(string->size + 1, size));
+    }
+    string->buf.heap.arr = arr;
+    STR_TAG(*string) = STR_HEAP;
 }
 
+/* Sets the size to len, growing the buffer when len plus the terminator does not fit */
 static void
-str_resize(String *string, size_t len, Arena *arena)
+str_resize(String *string, size_t len, Args args)
 {
     size_t capacity;
     MUST(string != NULL, "string is NULL in str_resize");
 
-    /* No expanding is required. */
-    if(len <= string->capacity - string->size){
+    if(len < STR_CAPACITY(*string)){
+        string->size = len;
         return;
     }
 
     capacity = nearest_pow(len + 1);
     /* Overflow happens */
     if(capacity == 0){
-        capacity = string->size + len + 1;
+        capacity = len + 1;
     }
 
-    str_realloc(string, capacity, arena);
-    MUST(string->arr != NULL, "Error Allocating memory in str_resize");
+    str_realloc(string, capacity, args);
+    MUST(str_data(string) != NULL, "Error Allocating memory in str_resize");
 
-    string->capacity = capacity;
+    string->buf.heap.capacity = capacity;
     string->size = len;
 }
 
@@ -127,25 +144,24 @@ _str_insert_cstr_n_at(String *string, const char *cstr, size_t n, size_t pos, Ar
     MUST(string != NULL,                  "string is NULL in str_insert_cstr_n_at");
     MUST(cstr != NULL,                    "cstr is NULL in str_insert_cstr_n_at");
     MUST(pos <= string->size,             "pos out of bounds in str_insert_cstr_n_at");
-    MUST((n <= _strlen(cstr)) && (n > 0 && n <= _strlen(cstr)), "(n > 0 && n <= _strlen(cstr)) is not satisfied in str_insert_cstr_n_at");
 
     if(n == 0){
         return;
     }
 
     size_t oldsize = string->size;
-    str_resize(string, oldsize + n, args.arena);
+    str_resize(string, oldsize + n, args);
 
     // Move existing content to make room (if not inserting at end)
     if (pos < string->size) {
-        memmove(string->arr + pos + n,
-                string->arr + pos,
+        memmove(str_data(string) + pos + n,
+                str_data(string) + pos,
                 oldsize - pos);
     }
 
-    memcpy(string->arr + pos, cstr, n);
+    memcpy(str_data(string) + pos, cstr, n);
 
-    string->arr[string->size] = '\0';
+    str_data(string)[string->size] = '\0';
 }
 
 void
@@ -176,32 +192,21 @@ void
 str_set_at(String *string, size_t index, const char ch)
 {
     MUST(string != NULL,        "string is NULL in str_set_at");
-    MUST(string->arr != NULL,   "string->arr is NULL in str_set_at");
+    MUST(str_data(string) != NULL,   "string->arr is NULL in str_set_at");
     MUST(index < string->size, "index is out of bound in str_set_at");
-    string->arr[index] = ch;
+    str_data(string)[index] = ch;
 }
 
 void
 _str_append(String *dest, const String *src, Args args)
 {
-    char *ptr = NULL;
     MUST(dest != NULL,      "dest is NULL in str_append");
-    MUST(dest->arr != NULL, "dest->arr is NULL in str_append");
+    MUST(str_data(dest) != NULL, "dest->arr is NULL in str_append");
     MUST(src != NULL,       "src is NULL in str_append");
-    MUST(src->arr != NULL,  "src->arr is NULL in str_append");
-
-    if(dest == src){
-        ptr = _realloc(ptr, dest->size, src->size, args.arena);
-        memcpy(ptr, src->arr, src->size);
-    }
-    else{
-        ptr = src->arr;
-    }
+    MUST(str_data(src) != NULL,  "src->arr is NULL in str_append");
 
-    _str_append_cstr(dest, ptr, args);
-
-    if(dest == src && args.arena == NULL) 
-        free(ptr);
+    /* Also covers dest == src, the view is rebased if dest grows */
+    _str_append_sv(dest, sv_from_str(src), args);
 }
 
 void 
@@ -210,9 +215,10 @@ _str_set(String *dest, const String *src, Args args)
     MUST(src != NULL,  "src is NULL in str_set");
     MUST(dest != NULL, "dest is NULL in str_set");
 
-    str_resize(dest, src->size, args.arena);
+    str_resize(dest, src->size, args);
 
-    memcpy(dest->arr, src->arr, dest->size);
+    memcpy(str_data(dest), str_data(src), dest->size);
+    str_data(dest)[dest->size] = '\0';
 }
 
 void
@@ -221,31 +227,21 @@ _str_set_cstr(String *dest, const char *cstr, Args args)
     MUST(cstr != NULL,  "cstr is NULL in str_set_cstr");
     MUST(dest != NULL, "dest is NULL in str_set_cstr");
 
-    str_resize(dest, _strlen(cstr), args.arena);
-    MUST(dest->arr != NULL, "Error Allocating memory");
+    str_resize(dest, _strlen(cstr), args);
+    MUST(str_data(dest) != NULL, "Error Allocating memory");
 
-    memcpy(dest->arr, cstr, dest->size);
+    memcpy(str_data(dest), cstr, dest->size);
+    str_data(dest)[dest->size] = '\0';
 }
 
 void
 _str_substr(String *dest, const String *src, size_t pos, size_t length, Args args)
 {
-    size_t max_length;
-    MUST(dest != NULL, "src is NULL in str_substr");
-    MUST(src  != NULL, "dest is NULL in str_substr");
+    MUST(dest != NULL, "dest is NULL in str_substr");
+    MUST(src  != NULL, "src is NULL in str_substr");
     MUST(pos < src->size, "pos out of bound in str_substr");
 
-    // Calculate actual length to extract
-    max_length = src->size - pos;
-
-    length = MIN(length, max_length);
-
-    length = (dest->capacity > length ? length : STR_INIT_CAPACITY);
-    str_resize(dest, length, args.arena);
-    dest->size = length;
-
-    memcpy(dest->arr, src->arr + pos, length);
-    dest->arr[dest->size] = '\0';
+    _str_set_sv(dest, sv_substr(sv_from_str(src), pos, length), args);
 }
 
 static int
@@ -282,38 +278,575 @@ _stricmp(const char *cstr1, size_t len1, const char *cstr2, size_t len2)
     return (tolower(cstr1[i]) - tolower(cstr2[i]));
 }
 
-int
-str_find_cstr(const String *string, const char *cstr)
+/* Candidates from the first byte, filtered by the last one, from position i on */
+static size_t
+str_search_scalar(const char *hay, size_t n, const char *needle, size_t m, size_t i)
 {
-    size_t idx = 0;
-    MUST(string != NULL,      "string is NULL in str_find_cstr");
-    MUST(string->arr != NULL, "string->arr is NULL in str_find_cstr");
-    MUST(cstr  != NULL,       "cstr is NULL in str_find_cstr");
+    const char *p;
+
+    while(i + m <= n){
+        p = memchr(hay + i, needle[0], n - m + 1 - i);
+        if(p == NULL){
+            break;
+        }
+        i = p - hay;
+        if(hay[i + m - 1] == needle[m - 1] && memcmp(hay + i + 1, needle + 1, m - 2) == 0){
+            return i;
+        }
+        i++;
+    }
+    return STR_NPOS;
+}
 
-    size_t len = _strlen(cstr);
+#ifdef STR_X86
+/*
+    SIMD filter: lane j of a block is a candidate when hay[i + j] matches the
+    first needle byte and hay[i + j + m - 1] the last one, only those get a
+    memcmp. Blocks stop before the last vector load would leave the haystack.
+*/
+__attribute__((target("sse2"))) static size_t
+str_search_sse2(const char *hay, size_t n, const char *needle, size_t m)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last  = _mm_set1_epi8(needle[m - 1]);
+    __m128i a, b;
+    unsigned mask;
+    size_t i;
 
-    /* string to find(cstr) is bigger than string*/
-    if(len > string->size){
-        return -1;
+    for(i = 0; i + m - 1 + 16 <= n; i += 16){
+        a = _mm_loadu_si128((const __m128i*)(hay + i));
+        b = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        for(; mask != 0; mask &= mask - 1){
+            if(memcmp(hay + i + __builtin_ctz(mask) + 1, needle + 1, m - 2) == 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+    return str_search_scalar(hay, n, needle, m, i);
+}
+
+__attribute__((target("avx2"))) static size_t
+str_search_avx2(const char *hay, size_t n, const char *needle, size_t m)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last  = _mm256_set1_epi8(needle[m - 1]);
+    __m256i a, b;
+    unsigned mask;
+    size_t i;
+
+    for(i = 0; i + m - 1 + 32 <= n; i += 32){
+        a = _mm256_loadu_si256((const __m256i*)(hay + i));
+        b = _mm256_loadu_si256((const __m256i*)(hay + i + m - 1));
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                               _mm256_cmpeq_epi8(b, last)));
+        for(; mask != 0; mask &= mask - 1){
+            if(memcmp(hay + i + __builtin_ctz(mask) + 1, needle + 1, m - 2) == 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+    return str_search_scalar(hay, n, needle, m, i);
+}
+#endif
+
+/* Index of the byte pair a, b in StrSearcher.shift */
+#define STR_PAIR_HASH(a, b) ((unsigned char)((b) - ((a) << 3)))
+
+/*
+    Two-Way (Crochemore-Perrin) over a needle prepared by str_searcher_init.
+    Each window is first checked on its last two bytes: a pair the needle
+    ends far from (by hash, collisions only shorten the shift) moves the
+    window by that distance. Otherwise the right half is compared left to
+    right and the left half right to left; for periodic needles the prefix
+    known to match after a shift by the period (mem) is not compared again,
+    which keeps the scan linear.
+*/
+
+static size_t
+str_search_two_way(const StrSearcher *searcher, const char *hay, size_t n)
+{
+    const unsigned char *needle = (const unsigned char*)searcher->needle;
+    const unsigned char *h = (const unsigned char*)hay;
+    size_t m = searcher->size, ms = searcher->critical, i = 0, k, mem = 0, skip;
+
+    while(i + m <= n){
+        skip = searcher->shift[STR_PAIR_HASH(h[i + m - 2], h[i + m - 1])];
+        if(skip != 0){
+            i += skip;
+            mem = 0;
+            continue;
+        }
+
+        for(k = ms > mem ? ms : mem; k < m && needle[k] == h[i + k]; k++);
+        if(k < m){
+            i += k - ms + 1;
+            mem = 0;
+            continue;
+        }
+        for(k = ms; k > mem && needle[k - 1] == h[i + k - 1]; k--);
+        if(k <= mem){
+            return i;
+        }
+        i += searcher->period;
+        mem = searcher->periodic ? m - searcher->period : 0;
     }
+    return STR_NPOS;
+}
 
-    while(idx <= (string->size - len)){
-        if(_strcmp(string->arr + idx, len, cstr, len) == 0){
-            return idx;
+/*
+    Start of the maximal suffix of needle[0, m) under the byte order, or the
+    reversed one with reverse set, and its period in *period.
+*/
+static size_t
+str_max_suffix(const unsigned char *needle, size_t m, int reverse, size_t *period)
+{
+    size_t ms = 0, j = 1, k = 0, p = 1;
+    unsigned char a, b;
+
+    while(j + k < m){
+        a = needle[j + k];
+        b = needle[ms + k];
+        if(a == b){
+            if(k + 1 == p){
+                j += p;
+                k = 0;
+            } else{
+                k++;
+            }
+        } else if(reverse ? a > b : a < b){
+            j += k + 1;
+            k = 0;
+            p = j - ms;
+        } else{
+            ms = j++;
+            k = 0;
+            p = 1;
         }
-        idx++;
     }
-    return -1;
+    *period = p;
+    return ms;
+}
+
+/* Position of the first match in hay[0, n), STR_NPOS if there is none */
+static size_t
+str_search(const StrSearcher *searcher, const char *hay, size_t n)
+{
+    const char *needle = searcher->needle, *p;
+    size_t m = searcher->size;
+
+    if(m == 0){
+        return 0;
+    }
+    if(m > n){
+        return STR_NPOS;
+    }
+    if(m == 1){
+        p = memchr(hay, needle[0], n);
+        return p != NULL ? (size_t)(p - hay) : STR_NPOS;
+    }
+    if(m > STR_SEARCH_SHORT_MAX){
+        return str_search_two_way(searcher, hay, n);
+    }
+#ifdef STR_X86
+    switch(arena_simd_level()){
+    case ARENA_SIMD_AVX2:
+        return str_search_avx2(hay, n, needle, m);
+    case ARENA_SIMD_SSE2:
+        return str_search_sse2(hay, n, needle, m);
+    }
+#endif
+    return str_search_scalar(hay, n, needle, m, 0);
+}
+
+void
+str_searcher_init(StrSearcher *searcher, const char *needle, size_t size)
+{
+    const unsigned char *n = (const unsigned char*)needle;
+    size_t i, ms, ms_rev, period, period_rev;
+    MUST(searcher != NULL,               "searcher is NULL in str_searcher_init");
+    MUST(needle != NULL || size == 0,    "needle is NULL in str_searcher_init");
+
+    searcher->needle = needle;
+    searcher->size = size;
+    if(size <= STR_SEARCH_SHORT_MAX){
+        return;
+    }
+
+    for(i = 0; i < 256; ++i){
+        searcher->shift[i] = size - 1;
+    }
+    for(i = 1; i < size; ++i){
+        searcher->shift[STR_PAIR_HASH(n[i - 1], n[i])] = size - 1 - i;
+    }
+
+    /* The critical position is the later of the two maximal suffixes */
+    ms = str_max_suffix(n, size, 0, &period);
+    ms_rev = str_max_suffix(n, size, 1, &period_rev);
+    if(ms_rev > ms){
+        ms = ms_rev;
+        period = period_rev;
+    }
+    searcher->critical = ms;
+
+    /* The left half repeats with the period of the right one, or not at all */
+    if(period <= size - ms && memcmp(n, n + period, ms) == 0){
+        searcher->period = period;
+        searcher->periodic = 1;
+    } else{
+        searcher->period = (ms > size - ms ? ms : size - ms) + 1;
+        searcher->periodic = 0;
+    }
+}
+
+int
+str_searcher_find(const StrSearcher *searcher, const String *string)
+{
+    size_t pos;
+    MUST(searcher != NULL,    "searcher is NULL in str_searcher_find");
+    MUST(string != NULL,      "string is NULL in str_searcher_find");
+    MUST(str_data(string) != NULL, "string->arr is NULL in str_searcher_find");
+
+    pos = str_search(searcher, str_data(string), string->size);
+    return pos == STR_NPOS ? -1 : (int)pos;
+}
+
+void
+str_find_iter(StrFindIter *it, const String *string, const StrSearcher *searcher)
+{
+    MUST(it != NULL,          "it is NULL in str_find_iter");
+    MUST(string != NULL,      "string is NULL in str_find_iter");
+    MUST(str_data(string) != NULL || string->size == 0, "string->arr is NULL in str_find_iter");
+    MUST(searcher != NULL,    "searcher is NULL in str_find_iter");
+
+    it->searcher = searcher;
+    it->string = string;
+    it->pos = 0;
+    it->done = 0;
+}
+
+int
+str_find_next(StrFindIter *it, size_t *offset)
+{
+    size_t pos;
+    MUST(it != NULL, "it is NULL in str_find_next");
+
+    if(it->done || it->pos > it->string->size){
+        it->done = 1;
+        return 0;
+    }
+
+    pos = str_search(it->searcher, str_data(it->string) + it->pos, it->string->size - it->pos);
+    if(pos == STR_NPOS){
+        it->done = 1;
+        return 0;
+    }
+    pos += it->pos;
+
+    /* Skip the match, an empty one would be found again in the same place */
+    it->pos = pos + (it->searcher->size != 0 ? it->searcher->size : 1);
+    if(offset != NULL){
+        *offset = pos;
+    }
+    return 1;
+}
+
+size_t
+str_searcher_count(const StrSearcher *searcher, const String *string)
+{
+    StrFindIter it;
+    size_t count = 0;
+
+    str_find_iter(&it, string, searcher);
+    while(str_find_next(&it, NULL)){
+        count++;
+    }
+    return count;
+}
+
+static size_t
+str_count_n(const String *string, const char *needle, size_t size)
+{
+    StrSearcher searcher;
+    str_searcher_init(&searcher, needle, size);
+    return str_searcher_count(&searcher, string);
+}
+
+size_t
+str_count(const String *string1, const String *string2)
+{
+    MUST(string1 != NULL,      "string1 is NULL in str_count");
+    MUST(string2 != NULL,      "string2 is NULL in str_count");
+    MUST(str_data(string2) != NULL || string2->size == 0, "string2->arr is NULL in str_count");
+    return str_count_n(string1, str_data(string2), string2->size);
+}
+
+size_t
+str_count_cstr(const String *string, const char *cstr)
+{
+    MUST(string != NULL, "string is NULL in str_count_cstr");
+    MUST(cstr != NULL,   "cstr is NULL in str_count_cstr");
+    return str_count_n(string, cstr, _strlen(cstr));
+}
+
+/* One-off search, the searcher only builds a shift table when the needle is long */
+static int
+str_find_n(const String *string, const char *needle, size_t size)
+{
+    StrSearcher searcher;
+    str_searcher_init(&searcher, needle, size);
+    return str_searcher_find(&searcher, string);
+}
+
+int
+str_find_cstr(const String *string, const char *cstr)
+{
+    MUST(string != NULL,      "string is NULL in str_find_cstr");
+    MUST(str_data(string) != NULL, "string->arr is NULL in str_find_cstr");
+    MUST(cstr  != NULL,       "cstr is NULL in str_find_cstr");
+
+    return str_find_n(string, cstr, _strlen(cstr));
 }
 
 int
 str_find(const String *string1, const String *string2)
 {
     MUST(string1 != NULL,      "string1 is NULL in str_find");
-    MUST(string1->arr != NULL, "string1->arr is NULL in str_find");
+    MUST(str_data(string1) != NULL, "string1->arr is NULL in str_find");
     MUST(string2 != NULL,      "string2 is NULL in str_find");
-    MUST(string2->arr != NULL, "string2->arr is NULL in str_find");
-    return str_find_cstr(string1, string2->arr);
+    MUST(str_data(string2) != NULL, "string2->arr is NULL in str_find");
+    return str_find_n(string1, str_data(string2), string2->size);
+}
+
+StrMatcher *
+str_matcher_build(Arena *arena, const char **patterns, size_t n)
+{
+    StrMatcher *m;
+    uint32_t *fail, *queue, s, t, f;
+    size_t total = 0, max_states, head, tail, i, j, c, len;
+    MUST(arena != NULL,    "arena is NULL in str_matcher_build");
+    MUST(patterns != NULL, "patterns is NULL in str_matcher_build");
+
+    m = arena_alloc(arena, sizeof(*m));
+    memset(m->class_of, 0, sizeof(m->class_of));
+    m->classes = 1;
+    m->patterns = n;
+
+    /* Byte classes in order of first appearance, and a bound on the trie size */
+    for(i = 0; i < n; ++i){
+        MUST(patterns[i] != NULL && patterns[i][0] != '\0', "empty pattern in str_matcher_build");
+        for(j = 0; patterns[i][j] != '\0'; ++j){
+            c = (unsigned char)patterns[i][j];
+            if(m->class_of[c] == 0){
+                m->class_of[c] = (unsigned char)m->classes++;
+            }
+        }
+        total += j;
+    }
+    max_states = total + 1;
+    MUST(max_states * m->classes < STR_MATCHER_OUTPUT, "too many pattern bytes in str_matcher_build");
+
+    m->table    = arena_alloc(arena, max_states * m->classes * sizeof(uint32_t));
+    m->out      = arena_alloc(arena, max_states * sizeof(int32_t));
+    m->out_link = arena_alloc(arena, max_states * sizeof(uint32_t));
+    m->dup_next = arena_alloc(arena, (n != 0 ? n : 1) * sizeof(int32_t));
+    m->lengths  = arena_alloc(arena, (n != 0 ? n : 1) * sizeof(size_t));
+    fail        = arena_alloc(arena, max_states * sizeof(uint32_t));
+    queue       = arena_alloc(arena, max_states * sizeof(uint32_t));
+    memset(m->table, 0, max_states * m->classes * sizeof(uint32_t));
+    memset(m->out, 0xFF, max_states * sizeof(int32_t));
+
+    /* Trie, 0 is both the root and "no child" as nothing points back to the root yet */
+    m->states = 1;
+    for(i = 0; i < n; ++i){
+        s = 0;
+        for(len = 0; patterns[i][len] != '\0'; ++len){
+            c = m->class_of[(unsigned char)patterns[i][len]];
+            if(m->table[s * m->classes + c] == 0){
+                m->table[s * m->classes + c] = (uint32_t)m->states++;
+            }
+            s = m->table[s * m->classes + c];
+        }
+        m->lengths[i] = len;
+        m->dup_next[i] = m->out[s];
+        m->out[s] = (int32_t)i;
+    }
+
+    /* Breadth first: missing edges take the failure state's edge, turning the trie into a DFA */
+    head = tail = 0;
+    m->out_link[0] = 0;
+    for(c = 0; c < m->classes; ++c){
+        t = m->table[c];
+        if(t != 0){
+            fail[t] = 0;
+            m->out_link[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while(head < tail){
+        s = queue[head++];
+        f = fail[s];
+        for(c = 0; c < m->classes; ++c){
+            t = m->table[s * m->classes + c];
+            if(t == 0){
+                m->table[s * m->classes + c] = m->table[f * m->classes + c];
+                continue;
+            }
+            fail[t] = m->table[f * m->classes + c];
+            m->out_link[t] = m->out[fail[t]] >= 0 ? fail[t] : m->out_link[fail[t]];
+            queue[tail++] = t;
+        }
+    }
+
+    /* Entries become row offsets, the scan then needs no multiply; flag the states that report */
+    for(i = 0; i < m->states * m->classes; ++i){
+        t = m->table[i];
+        m->table[i] = t * (uint32_t)m->classes;
+        if(m->out[t] >= 0 || m->out_link[t] != 0){
+            m->table[i] |= STR_MATCHER_OUTPUT;
+        }
+    }
+    return m;
+}
+
+size_t
+str_matcher_scan(const StrMatcher *matcher, const String *string, StrMatchFn fn, void *ctx)
+{
+    const uint32_t *table;
+    const unsigned char *p;
+    uint32_t row = 0, state, o;
+    size_t count = 0, classes, i;
+    int32_t pat;
+    StrMatch match;
+    MUST(matcher != NULL,     "matcher is NULL in str_matcher_scan");
+    MUST(string != NULL,      "string is NULL in str_matcher_scan");
+    MUST(str_data(string) != NULL || string->size == 0, "string->arr is NULL in str_matcher_scan");
+
+    table = matcher->table;
+    classes = matcher->classes;
+    p = (const unsigned char*)str_data(string);
+    for(i = 0; i < string->size; ++i){
+        row = table[row + matcher->class_of[p[i]]];
+        if(!(row & STR_MATCHER_OUTPUT)){
+            continue;
+        }
+        row &= ~STR_MATCHER_OUTPUT;
+        state = row / classes;
+
+        for(o = matcher->out[state] >= 0 ? state : matcher->out_link[state]; o != 0; o = matcher->out_link[o]){
+            for(pat = matcher->out[o]; pat >= 0; pat = matcher->dup_next[pat]){
+                count++;
+                if(fn == NULL){
+                    continue;
+                }
+                match.pattern = (size_t)pat;
+                match.offset = i + 1 - matcher->lengths[pat];
+                if(fn(match, ctx) != 0){
+                    return count;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+static void *
+_alloc(size_t size, Args args)
+{
+    if (args.arena != NULL){
+        return arena_alloc_tagged(args.arena, size, args.tag);
+    }
+    else {
+        return malloc(size);
+    }
+}
+
+static void
+str_replace_n(String *dest, const String *src, const char *needle, size_t needle_size,
+              const char *replacement, size_t replacement_size, size_t limit, Args args)
+{
+    StrSearcher searcher;
+    StrFindIter it;
+    size_t count = 0, size, pos, from = 0, i;
+    char *out, *w, small[STR_SSO_CAPACITY];
+    MUST(dest != NULL,                          "dest is NULL in str_replace");
+    MUST(src != NULL,                           "src is NULL in str_replace");
+    MUST(str_data(src) != NULL || src->size == 0,    "src->arr is NULL in str_replace");
+    MUST(needle != NULL || needle_size == 0,    "needle is NULL in str_replace");
+    MUST(replacement != NULL || replacement_size == 0, "replacement is NULL in str_replace");
+
+    str_searcher_init(&searcher, needle, needle_size);
+    str_find_iter(&it, src, &searcher);
+    while(count < limit && str_find_next(&it, NULL)){
+        count++;
+    }
+    if(count == 0 && dest == src){
+        return;
+    }
+
+    /* Matches never overlap, so src->size - count * needle_size cannot wrap */
+    size = src->size - count * needle_size + count * replacement_size;
+    out = size < STR_SSO_CAPACITY ? small : _alloc(size + 1, args);
+    MUST(out != NULL, "Error Allocating memory in str_replace");
+
+    w = out;
+    str_find_iter(&it, src, &searcher);
+    for(i = 0; i < count && str_find_next(&it, &pos); ++i){
+        memcpy(w, str_data(src) + from, pos - from);
+        w += pos - from;
+        if(replacement_size != 0){
+            memcpy(w, replacement, replacement_size);
+            w += replacement_size;
+        }
+        from = pos + needle_size;
+    }
+    if(src->size != from){
+        memcpy(w, str_data(src) + from, src->size - from);
+    }
+    out[size] = '\0';
+
+    /* Only now, the old contents of dest may be what src was read from */
+    if(args.arena == NULL && !STR_IS_INLINE(*dest)){
+        free(dest->buf.heap.arr);
+    }
+    if(out == small){
+        memcpy(dest->buf.sso, small, size + 1);
+        STR_TAG(*dest) = 0;
+    }
+    else{
+        dest->buf.heap.arr = out;
+        dest->buf.heap.capacity = size + 1;
+        STR_TAG(*dest) = STR_HEAP;
+    }
+    dest->size = size;
+}
+
+void
+_str_replace(String *dest, const String *src, const String *needle, const String *replacement, Args args)
+{
+    MUST(needle != NULL && replacement != NULL, "needle or replacement is NULL in str_replace");
+    str_replace_n(dest, src, str_data(needle), needle->size, str_data(replacement), replacement->size, 1, args);
+}
+
+void
+_str_replace_cstr(String *dest, const String *src, const char *needle, const char *replacement, Args args)
+{
+    MUST(needle != NULL && replacement != NULL, "needle or replacement is NULL in str_replace_cstr");
+    str_replace_n(dest, src, needle, _strlen(needle), replacement, _strlen(replacement), 1, args);
+}
+
+void
+_str_replace_all(String *dest, const String *src, const String *needle, const String *replacement, Args args)
+{
+    MUST(needle != NULL && replacement != NULL, "needle or replacement is NULL in str_replace_all");
+    str_replace_n(dest, src, str_data(needle), needle->size, str_data(replacement), replacement->size, SIZE_MAX, args);
+}
+
+void
+_str_replace_all_cstr(String *dest, const String *src, const char *needle, const char *replacement, Args args)
+{
+    MUST(needle != NULL && replacement != NULL, "needle or replacement is NULL in str_replace_all_cstr");
+    str_replace_n(dest, src, needle, _strlen(needle), replacement, _strlen(replacement), SIZE_MAX, args);
 }
 
 void
@@ -322,13 +855,13 @@ str_reverse(const String *string)
     size_t i, j, size;
     char temp;
     MUST(string != NULL, "string  is NULL in str_reverse");
-    MUST(string->arr != NULL, "string->arr  is NULL in str_reverse");
+    MUST(str_data(string) != NULL, "string->arr  is NULL in str_reverse");
 
     size = string->size;
     for(i = 0, j = size-1; i < size/2; i++, j--){
-        temp = string->arr[i];
-        string->arr[i] = string->arr[j];
-        string->arr[j] = temp;
+        temp = str_data(string)[i];
+        str_data(string)[i] = str_data(string)[j];
+        str_data(string)[j] = temp;
     }
 }
 
@@ -337,10 +870,10 @@ str_lower(String *string)
 {
     size_t i;
     MUST(string      != NULL, "string is NULL in str_lower");
-    MUST(string->arr != NULL, "string->arr  is NULL in str_lower");
+    MUST(str_data(string) != NULL, "string->arr  is NULL in str_lower");
 
     for(i = 0; i < string->size; ++i){
-        string->arr[i] =  tolower(string->arr[i]);
+        str_data(string)[i] =  tolower(str_data(string)[i]);
     }
 }
 
@@ -349,10 +882,10 @@ str_upper(String *string)
 {
     size_t i;
     MUST(string        != NULL, "string is NULL in str_lower");
-    MUST(string->arr != NULL, "string->arr  is NULL in str_lower");
+    MUST(str_data(string) != NULL, "string->arr  is NULL in str_lower");
 
     for(i = 0; i < string->size; ++i){
-        string->arr[i] =  toupper(string->arr[i]);
+        str_data(string)[i] =  toupper(str_data(string)[i]);
     }
 }
 
@@ -360,11 +893,11 @@ char
 str_at(const String *string, size_t index)
 {
     MUST(string != NULL,       "string is NULL in str_at");
-    MUST(string->arr != NULL,  "string->arr  is NULL in str_at");
+    MUST(str_data(string) != NULL,  "string->arr  is NULL in str_at");
     MUST(index < string->size, "index out of bounds in str_at");
     MUST(index >= 0,           "index is negative");
 
-    return string->arr[index];
+    return str_data(string)[index];
 }
 
 int
@@ -372,10 +905,10 @@ str_compare(const String *string1, const String *string2)
 {
     MUST(string1 != NULL, "string1 is NULL in str_compare");
     MUST(string2 != NULL, "string2 is NULL in str_compare");
-    MUST(string1->arr != NULL, "string1->arr  is NULL in str_compare");
-    MUST(string2->arr != NULL, "string2->arr is NULL in str_compare");
+    MUST(str_data(string1) != NULL, "string1->arr  is NULL in str_compare");
+    MUST(str_data(string2) != NULL, "string2->arr is NULL in str_compare");
 
-    return _strcmp(string1->arr, string1->size, string2->arr, string2->size);
+    return _strcmp(str_data(string1), string1->size, str_data(string2), string2->size);
 }
 
 int
@@ -383,10 +916,10 @@ str_icompare(const String *string1, const String *string2)
 {
     MUST(string1 != NULL, "string1 is NULL in str_icompare");
     MUST(string2 != NULL, "string2 is NULL in str_icompare");
-    MUST(string1->arr != NULL, "string1->arr  is NULL in str_icompare");
-    MUST(string2->arr != NULL, "string2->arr is NULL in str_icompare");
+    MUST(str_data(string1) != NULL, "string1->arr  is NULL in str_icompare");
+    MUST(str_data(string2) != NULL, "string2->arr is NULL in str_icompare");
 
-    return _stricmp(string1->arr, string1->size, string2->arr, string2->size);
+    return _stricmp(str_data(string1), string1->size, str_data(string2), string2->size);
 }
 
 
@@ -395,18 +928,18 @@ str_trim_left(String *string)
 {
     size_t i = 0, newsize = 0;
     MUST(string != NULL,      "string is NULL in str_trim_left");
-    MUST(string->arr != NULL, "string->arr is NULL in str_trim_left");
+    MUST(str_data(string) != NULL, "string->arr is NULL in str_trim_left");
 
-    while (i < string->size && string->arr[i] == ' ') {
+    while (i < string->size && str_data(string)[i] == ' ') {
         i++;
     }
 
     if (i > 0) {
         newsize = string->size - i;
         // shift left
-        memmove(string->arr, string->arr + i, newsize);
+        memmove(str_data(string), str_data(string) + i, newsize);
         string->size = newsize;
-        string->arr[newsize] = '\0';  // keep null terminator
+        str_data(string)[newsize] = '\0';  // keep null terminator
     }
 }
 
@@ -416,55 +949,59 @@ str_trim_right(String *string)
 {
     size_t i = 0;
     MUST(string != NULL,      "string is NULL in str_trim_right");
-    MUST(string->arr != NULL, "string->arr is NULL in str_trim_right");
+    MUST(str_data(string) != NULL, "string->arr is NULL in str_trim_right");
 
     i = string->size;
-    while(string->arr[i - 1] == ' '){
+    while(str_data(string)[i - 1] == ' '){
         i--;
     }
     string->size = i;
-    string->arr[i] = '\0';
+    str_data(string)[i] = '\0';
 }
 
-void
-str_remove_cstr(String *string, const char *cstr)
+static void
+str_remove_n(String *string, const char *needle, size_t size)
 {
     int pos;
-    size_t cstr_len;
-    MUST(string != NULL,      "string is NULL in str_remove_cstr");
-    MUST(string->arr != NULL, "string->arr is NULL in str_remove_cstr");
-    MUST(cstr != NULL,        "cstr is NULL in str_remove_cstr");
 
-    pos = str_find_cstr(string, cstr);
-    if(pos < 0){
+    pos = str_find_n(string, needle, size);
+    if(pos < 0 || size == 0){
         return;
     }
 
-    cstr_len = _strlen(cstr);
+    memmove(str_data(string) + pos,
+            str_data(string) + pos + size,
+            string->size - size - pos + 1);
+
+    string->size -= size;
+}
 
-    memmove(string->arr + pos, 
-            string->arr + pos + cstr_len,
-            string->size - cstr_len - pos + 1);
+void
+str_remove_cstr(String *string, const char *cstr)
+{
+    MUST(string != NULL,      "string is NULL in str_remove_cstr");
+    MUST(str_data(string) != NULL, "string->arr is NULL in str_remove_cstr");
+    MUST(cstr != NULL,        "cstr is NULL in str_remove_cstr");
 
-    string->size -= cstr_len;
+    str_remove_n(string, cstr, _strlen(cstr));
 }
 
 void
 str_remove(String *string1, const String *string2)
 {
     MUST(string1 != NULL,      "string1 is NULL in str_remove");
-    MUST(string1->arr != NULL, "string1->arr is NULL in str_remove");
+    MUST(str_data(string1) != NULL, "string1->arr is NULL in str_remove");
     MUST(string2 != NULL,      "string2 is NULL in str_remove");
-    MUST(string2->arr != NULL, "string2->arr is NULL in str_remove");
+    MUST(str_data(string2) != NULL, "string2->arr is NULL in str_remove");
 
-    str_remove_cstr(string1, string2->arr);
+    str_remove_n(string1, str_data(string2), string2->size);
 }
 
 void
 str_trim(String *string)
 {
     MUST(string != NULL,      "string is NULL in str_trim");
-    MUST(string->arr != NULL, "string->arr is NULL in str_trim");
+    MUST(str_data(string) != NULL, "string->arr is NULL in str_trim");
     str_trim_right(string);
     str_trim_left(string);
 }
@@ -473,25 +1010,421 @@ void
 str_free(String *string)
 {
     MUST(string != NULL, "string is NULL in str_free");
-    free(string->arr);
+    if(!STR_IS_INLINE(*string)){
+        free(string->buf.heap.arr);
+    }
 
-    string->size = 0;
-    string->capacity = 0;
-    string->arr = NULL;
-    free(string->arr);
+    *string = (String){0};
+}
+
+StringView
+sv_from_str(const String *string)
+{
+    MUST(string != NULL, "string is NULL in sv_from_str");
+    return sv_from_parts(str_data(string), string->size);
+}
+
+StringView
+sv_from_cstr(const char *cstr)
+{
+    MUST(cstr != NULL, "cstr is NULL in sv_from_cstr");
+    return sv_from_parts(cstr, _strlen(cstr));
+}
+
+StringView
+sv_from_parts(const char *ptr, size_t len)
+{
+    StringView sv;
+    MUST(ptr != NULL || len == 0, "ptr is NULL in sv_from_parts");
+    sv.ptr = ptr;
+    sv.len = len;
+    return sv;
+}
+
+StringView
+sv_substr(StringView sv, size_t pos, size_t length)
+{
+    MUST(pos <= sv.len, "pos out of bound in sv_substr");
+    return sv_from_parts(sv.ptr + pos, MIN(length, sv.len - pos));
+}
+
+StringView
+sv_trim_left(StringView sv)
+{
+    while(sv.len > 0 && sv.ptr[0] == ' '){
+        sv.ptr++;
+        sv.len--;
+    }
+    return sv;
+}
+
+StringView
+sv_trim_right(StringView sv)
+{
+    while(sv.len > 0 && sv.ptr[sv.len - 1] == ' '){
+        sv.len--;
+    }
+    return sv;
+}
+
+StringView
+sv_trim(StringView sv)
+{
+    return sv_trim_left(sv_trim_right(sv));
+}
+
+int
+sv_find(StringView sv, StringView needle)
+{
+    StrSearcher searcher;
+    size_t pos;
+
+    str_searcher_init(&searcher, needle.ptr, needle.len);
+    pos = str_search(&searcher, sv.ptr, sv.len);
+    return pos == STR_NPOS ? -1 : (int)pos;
+}
+
+int
+sv_find_cstr(StringView sv, const char *cstr)
+{
+    MUST(cstr != NULL, "cstr is NULL in sv_find_cstr");
+    return sv_find(sv, sv_from_cstr(cstr));
+}
+
+int
+sv_find_ch(StringView sv, const char ch)
+{
+    const char *p;
+
+    if(sv.len == 0){
+        return -1;
+    }
+    p = memchr(sv.ptr, ch, sv.len);
+    return p != NULL ? (int)(p - sv.ptr) : -1;
+}
+
+int
+sv_compare(StringView sv1, StringView sv2)
+{
+    return _strcmp(sv1.ptr, sv1.len, sv2.ptr, sv2.len);
+}
+
+int
+sv_icompare(StringView sv1, StringView sv2)
+{
+    return _stricmp(sv1.ptr, sv1.len, sv2.ptr, sv2.len);
+}
+
+int
+sv_equal(StringView sv1, StringView sv2)
+{
+    return sv1.len == sv2.len && (sv1.len == 0 || memcmp(sv1.ptr, sv2.ptr, sv1.len) == 0);
+}
+
+int
+sv_starts_with(StringView sv, StringView prefix)
+{
+    return prefix.len <= sv.len && sv_equal(sv_from_parts(sv.ptr, prefix.len), prefix);
+}
+
+int
+sv_ends_with(StringView sv, StringView suffix)
+{
+    return suffix.len <= sv.len &&
+           sv_equal(sv_from_parts(sv.ptr + sv.len - suffix.len, suffix.len), suffix);
+}
+
+void
+_str_set_sv(String *dest, StringView sv, Args args)
+{
+    MUST(dest != NULL, "dest is NULL in str_set_sv");
+
+    /* A view into dest is shorter than its capacity, so this never moves it */
+    str_resize(dest, sv.len, args);
+    if(sv.len > 0){
+        memmove(str_data(dest), sv.ptr, sv.len);
+    }
+    str_data(dest)[dest->size] = '\0';
+}
+
+void
+_str_append_sv(String *dest, StringView sv, Args args)
+{
+    const char *data;
+    size_t oldsize, offset = 0;
+    int inside;
+    MUST(dest != NULL, "dest is NULL in str_append_sv");
+
+    if(sv.len == 0){
+        return;
+    }
+
+    /* Growing may move the contents of dest, a view into them has to follow */
+    data = str_data(dest);
+    inside = data != NULL && sv.ptr >= data && sv.ptr < data + STR_CAPACITY(*dest);
+    if(inside){
+        offset = sv.ptr - data;
+    }
+
+    oldsize = dest->size;
+    str_resize(dest, oldsize + sv.len, args);
+    if(inside){
+        sv.ptr = str_data(dest) + offset;
+    }
+
+    memcpy(str_data(dest) + oldsize, sv.ptr, sv.len);
+    str_data(dest)[dest->size] = '\0';
+}
+
+/* Delimiter bitmask of p[0, n), n at most STR_SPLIT_BLOCK */
+static uint64_t
+str_split_mask_scalar(const StrSplitIter *it, const char *p, size_t n)
+{
+    uint64_t mask = 0;
+    size_t i, j;
+
+    for(i = 0; i < n; ++i){
+        if(it->set_size > STR_SPLIT_SIMD_SET){
+            mask |= (uint64_t)it->set[(unsigned char)p[i]] << i;
+            continue;
+        }
+        for(j = 0; j < it->set_size; ++j){
+            if(p[i] == (char)it->set[j]){
+                mask |= (uint64_t)1 << i;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+#ifdef STR_X86
+__attribute__((target("sse2"))) static uint64_t
+str_split_mask_sse2(const StrSplitIter *it, const char *p)
+{
+    __m128i v[4], hit[4], d;
+    uint64_t mask = 0;
+    size_t j, k;
+
+    for(k = 0; k < 4; ++k){
+        v[k] = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+        hit[k] = _mm_setzero_si128();
+    }
+    for(j = 0; j < it->set_size; ++j){
+        d = _mm_set1_epi8((char)it->set[j]);
+        for(k = 0; k < 4; ++k){
+            hit[k] = _mm_or_si128(hit[k], _mm_cmpeq_epi8(v[k], d));
+        }
+    }
+    for(k = 0; k < 4; ++k){
+        mask |= (uint64_t)(unsigned)_mm_movemask_epi8(hit[k]) << (16 * k);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+str_split_mask_avx2(const StrSplitIter *it, const char *p)
+{
+    __m256i lo, hi, hit_lo, hit_hi, d;
+    size_t j;
+
+    lo = _mm256_loadu_si256((const __m256i*)p);
+    hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+    hit_lo = _mm256_setzero_si256();
+    hit_hi = _mm256_setzero_si256();
+    for(j = 0; j < it->set_size; ++j){
+        d = _mm256_set1_epi8((char)it->set[j]);
+        hit_lo = _mm256_or_si256(hit_lo, _mm256_cmpeq_epi8(lo, d));
+        hit_hi = _mm256_or_si256(hit_hi, _mm256_cmpeq_epi8(hi, d));
+    }
+    return (uint64_t)(unsigned)_mm256_movemask_epi8(hit_lo) |
+           (uint64_t)(unsigned)_mm256_movemask_epi8(hit_hi) << 32;
+}
+#endif
+
+static uint64_t
+str_split_mask(const StrSplitIter *it, const char *p, size_t n)
+{
+#ifdef STR_X86
+    if(n == STR_SPLIT_BLOCK && it->set_size <= STR_SPLIT_SIMD_SET){
+        switch(arena_simd_level()){
+        case ARENA_SIMD_AVX2:
+            return str_split_mask_avx2(it, p);
+        case ARENA_SIMD_SSE2:
+            return str_split_mask_sse2(it, p);
+        }
+    }
+#endif
+    return str_split_mask_scalar(it, p, n);
+}
+
+/* Offset of the next delimiter at or after it->pos, STR_NPOS if there is none */
+static size_t
+str_split_scan(StrSplitIter *it)
+{
+    size_t n;
+
+    if(it->kind == STR_SPLIT_STR){
+        n = str_search(&it->searcher, it->base + it->pos, it->end - it->pos);
+        return n == STR_NPOS ? n : it->pos + n;
+    }
+    while(it->hits == 0){
+        if(it->next >= it->end){
+            return STR_NPOS;
+        }
+        it->block = it->next;
+        n = MIN(STR_SPLIT_BLOCK, it->end - it->block);
+        it->hits = str_split_mask(it, it->base + it->block, n);
+        it->next += n;
+    }
+    return it->block + __builtin_ctzll(it->hits);
+}
+
+static void
+str_split_init(StrSplitIter *it, StringView sv, int kind, unsigned flags)
+{
+    it->base = sv.ptr != NULL ? sv.ptr : "";
+    it->end = sv.len;
+    it->pos = 0;
+    it->block = 0;
+    it->next = 0;
+    it->hits = 0;
+    it->kind = kind;
+    it->flags = flags;
+    it->done = 0;
+    it->set_size = 0;
+}
+
+void
+str_split_init_byte(StrSplitIter *it, StringView sv, const char delim, unsigned flags)
+{
+    MUST(it != NULL, "it is NULL in str_split_init_byte");
+    str_split_init(it, sv, STR_SPLIT_BYTE, flags);
+    it->set[0] = (unsigned char)delim;
+    it->set_size = 1;
+}
+
+void
+str_split_init_set(StrSplitIter *it, StringView sv, const char *set, unsigned flags)
+{
+    size_t i, n;
+    MUST(it != NULL,  "it is NULL in str_split_init_set");
+    MUST(set != NULL, "set is NULL in str_split_init_set");
+
+    n = _strlen(set);
+    MUST(n > 0, "set is empty in str_split_init_set");
+    if(n == 1){
+        str_split_init_byte(it, sv, set[0], flags);
+        return;
+    }
+
+    str_split_init(it, sv, STR_SPLIT_SET, flags);
+    it->set_size = n;
+    if(n <= STR_SPLIT_SIMD_SET){
+        memcpy(it->set, set, n);
+        return;
+    }
+    memset(it->set, 0, sizeof(it->set));
+    for(i = 0; i < n; ++i){
+        it->set[(unsigned char)set[i]] = 1;
+    }
+}
+
+void
+str_split_init_str(StrSplitIter *it, StringView sv, const char *delim, unsigned flags)
+{
+    size_t n;
+    MUST(it != NULL,    "it is NULL in str_split_init_str");
+    MUST(delim != NULL, "delim is NULL in str_split_init_str");
+
+    n = _strlen(delim);
+    MUST(n > 0, "delim is empty in str_split_init_str");
+    if(n == 1){
+        str_split_init_byte(it, sv, delim[0], flags);
+        return;
+    }
+
+    str_split_init(it, sv, STR_SPLIT_STR, flags);
+    str_searcher_init(&it->searcher, delim, n);
+}
+
+int
+str_split_next(StrSplitIter *it, StringView *field)
+{
+    size_t pos;
+    MUST(it != NULL,    "it is NULL in str_split_next");
+    MUST(field != NULL, "field is NULL in str_split_next");
+
+    while(!it->done){
+        pos = str_split_scan(it);
+        if(pos == STR_NPOS){
+            *field = sv_from_parts(it->base + it->pos, it->end - it->pos);
+            it->done = 1;
+        }
+        else{
+            *field = sv_from_parts(it->base + it->pos, pos - it->pos);
+            if(it->kind == STR_SPLIT_STR){
+                it->pos = pos + it->searcher.size;
+            }
+            else{
+                it->hits &= it->hits - 1;
+                it->pos = pos + 1;
+            }
+        }
+        if(field->len > 0 || !(it->flags & STR_SPLIT_SKIP_EMPTY)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t
+str_split_collect(StrSplitIter *it, Arena *arena, StrViews *out)
+{
+    StringView field;
+    size_t count = 0;
+    MUST(it != NULL,    "it is NULL in str_split_collect");
+    MUST(arena != NULL, "arena is NULL in str_split_collect");
+    MUST(out != NULL,   "out is NULL in str_split_collect");
+
+    while(str_split_next(it, &field)){
+        arena_arr_append(arena, out, field);
+        count++;
+    }
+    return count;
+}
+
+size_t
+str_split(Arena *arena, StrViews *out, const String *string, const char delim)
+{
+    StrSplitIter it;
+    MUST(string != NULL, "string is NULL in str_split");
+
+    str_split_init_byte(&it, sv_from_str(string), delim, 0);
+    return str_split_collect(&it, arena, out);
+}
+
+/* Grows the buffer to exactly capacity bytes, str_resize would round up to a power of two */
+static void
+str_reserve(String *string, size_t capacity, Args args)
+{
+    if(STR_CAPACITY(*string) >= capacity){
+        return;
+    }
+    str_realloc(string, capacity, args);
+    MUST(str_data(string) != NULL, "Error Allocating memory in str_reserve");
+    string->buf.heap.capacity = capacity;
 }
 
 int
 _str_from_file(String *string, const char *filename, Args args)
 {
-    int fd;
+    struct stat st;
     ssize_t read_bytes;
-    #define SIZE (4096)
-    char buf[SIZE] = {0};
+    int fd;
 
-    string->size = 0;
     if (string == NULL) {
-        fprintf(stderr, "Invalid string pointer for file %s, %s\n", filename, strerror(errno));
+        fprintf(stderr, "Invalid string pointer for file %s\n", filename);
         return -1;
     }
 
@@ -500,17 +1433,372 @@ _str_from_file(String *string, const char *filename, Args args)
         fprintf(stderr, "Error opening the file %s, %s\n", filename, strerror(errno));
         return -1;
     }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    /*
+        Regular files are read straight into a buffer of their size, plus one
+        byte for the read that sees EOF and one for the terminator. Pipes and
+        files that grow meanwhile double from STR_FILE_CHUNK.
+    */
+    string->size = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        str_reserve(string, (size_t)st.st_size + 2, args);
+    }
+    else {
+        str_reserve(string, STR_FILE_CHUNK, args);
+    }
 
-    while ((read_bytes = read(fd, buf, SIZE)) > 0) {
-        str_append_cstr_n(string, buf, read_bytes, .arena=args.arena);
+    for (;;) {
+        if (string->size + 1 == STR_CAPACITY(*string)) {
+            str_reserve(string, STR_CAPACITY(*string) * 2, args);
+        }
+        read_bytes = read(fd, str_data(string) + string->size, STR_CAPACITY(*string) - 1 - string->size);
+        if (read_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes <= 0) {
+            break;
+        }
+        string->size += read_bytes;
     }
+    str_data(string)[string->size] = '\0';
 
     if (read_bytes < 0) {
-        fprintf(stderr, "Error reading from the file %s\n", filename);
+        fprintf(stderr, "Error reading from the file %s, %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+int
+str_file_map(StrFileMap *map, const char *filename)
+{
+    struct stat st;
+    void *addr;
+    int fd;
+    MUST(map != NULL,      "map is NULL in str_file_map");
+    MUST(filename != NULL, "filename is NULL in str_file_map");
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening the file %s, %s\n", filename, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error reading the size of %s, %s\n", filename, strerror(errno));
         close(fd);
         return -1;
     }
 
+    /* mmap rejects empty mappings, an empty file is an empty view */
+    map->addr = NULL;
+    map->length = 0;
+    map->view = sv_from_parts(NULL, 0);
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "Error mapping the file %s, %s\n", filename, strerror(errno));
+        return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    map->addr = addr;
+    map->length = (size_t)st.st_size;
+    map->view = sv_from_parts(addr, map->length);
     return 0;
 }
+
+void
+str_file_unmap(StrFileMap *map)
+{
+    MUST(map != NULL, "map is NULL in str_file_unmap");
+    if (map->addr != NULL) {
+        munmap(map->addr, map->length);
+    }
+    map->addr = NULL;
+    map->length = 0;
+    map->view = sv_from_parts(NULL, 0);
+}
+
+void
+_str_reader_init(StrReader *reader, int fd, size_t capacity, Args args)
+{
+    MUST(reader != NULL, "reader is NULL in str_reader_init");
+    MUST(fd >= 0,        "fd is invalid in str_reader_init");
+
+    if(capacity == 0){
+        capacity = STR_READER_CAPACITY;
+    }
+    reader->fd = fd;
+    reader->arena = args.arena;
+    reader->buf = _alloc(capacity, args);
+    MUST(reader->buf != NULL, "Error Allocating memory in str_reader_init");
+    reader->capacity = capacity;
+    reader->start = 0;
+    reader->scan = 0;
+    reader->end = 0;
+    reader->eof = 0;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+/* Room after end: slides the partial record to the front, or doubles the buffer when it fills it */
+static void
+str_reader_make_room(StrReader *reader)
+{
+    Args args = STR_ARGS("str_reader_next", .arena = reader->arena);
+
+    if(reader->end < reader->capacity){
+        return;
+    }
+    if(reader->start > 0){
+        memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->scan -= reader->start;
+        reader->start = 0;
+        return;
+    }
+    reader->buf = _realloc(reader->buf, reader->capacity, reader->capacity * 2, args);
+    MUST(reader->buf != NULL, "Error Allocating memory in str_reader_next");
+    reader->capacity *= 2;
+}
+
+int
+str_reader_next_delim(StrReader *reader, const char delim, StringView *record)
+{
+    const char *p;
+    ssize_t n;
+    MUST(reader != NULL, "reader is NULL in str_reader_next");
+    MUST(record != NULL, "record is NULL in str_reader_next");
+
+    for(;;){
+        p = NULL;
+        if(reader->scan < reader->end){
+            p = memchr(reader->buf + reader->scan, delim, reader->end - reader->scan);
+        }
+        if(p != NULL){
+            *record = sv_from_parts(reader->buf + reader->start, p - (reader->buf + reader->start));
+            reader->start = reader->scan = p - reader->buf + 1;
+            return 1;
+        }
+        reader->scan = reader->end;
+
+        if(reader->eof){
+            if(reader->start == reader->end){
+                return 0;
+            }
+            *record = sv_from_parts(reader->buf + reader->start, reader->end - reader->start);
+            reader->start = reader->end;
+            return 1;
+        }
+
+        str_reader_make_room(reader);
+        n = read(reader->fd, reader->buf + reader->end, reader->capacity - reader->end);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        if(n == 0){
+            reader->eof = 1;
+        }
+        reader->end += n;
+    }
+}
+
+int
+str_reader_next(StrReader *reader, StringView *line)
+{
+    return str_reader_next_delim(reader, '\n', line);
+}
+
+void
+str_reader_free(StrReader *reader)
+{
+    MUST(reader != NULL, "reader is NULL in str_reader_free");
+    if(reader->arena == NULL){
+        free(reader->buf);
+    }
+    reader->buf = NULL;
+    reader->capacity = 0;
+    reader->start = reader->scan = reader->end = 0;
+}
+
+/* Moves the gap so that it starts at pos */
+static void
+str_gap_move(StrGap *gap, size_t pos)
+{
+    size_t n;
+
+    if(pos < gap->gap_start){
+        n = gap->gap_start - pos;
+        memmove(gap->buf + gap->gap_end - n, gap->buf + pos, n);
+        gap->gap_start -= n;
+        gap->gap_end -= n;
+    }
+    else if(pos > gap->gap_start){
+        n = pos - gap->gap_start;
+        memmove(gap->buf + gap->gap_start, gap->buf + gap->gap_end, n);
+        gap->gap_start += n;
+        gap->gap_end += n;
+    }
+}
+
+/* Widens the gap to at least n bytes, the text after it moves to the end of the new buffer */
+static void
+str_gap_reserve(StrGap *gap, size_t n, Args args)
+{
+    size_t size, after, capacity;
+    char *buf;
+
+    if(gap->gap_end - gap->gap_start >= n){
+        return;
+    }
+    size = gap->capacity - (gap->gap_end - gap->gap_start);
+    after = gap->capacity - gap->gap_end;
+
+    capacity = MAX(gap->capacity * 2, (size_t)STR_GAP_INIT_CAPACITY);
+    if(capacity - size < n){
+        capacity = nearest_pow(size + n);
+        /* Overflow happens */
+        if(capacity == 0){
+            capacity = size + n;
+        }
+    }
+
+    buf = _alloc(capacity, args);
+    MUST(buf != NULL, "Error Allocating memory in str_gap_reserve");
+    if(gap->gap_start > 0){
+        memcpy(buf, gap->buf, gap->gap_start);
+    }
+    if(after > 0){
+        memcpy(buf + capacity - after, gap->buf + gap->gap_end, after);
+    }
+    if(args.arena == NULL){
+        free(gap->buf);
+    }
+
+    gap->buf = buf;
+    gap->capacity = capacity;
+    gap->gap_end = capacity - after;
+}
+
+void
+_str_gap_insert_n(StrGap *gap, size_t pos, const char *cstr, size_t n, Args args)
+{
+    MUST(gap != NULL,                  "gap is NULL in str_gap_insert_n");
+    MUST(cstr != NULL || n == 0,       "cstr is NULL in str_gap_insert_n");
+    MUST(pos <= str_gap_size(gap),     "pos out of bounds in str_gap_insert_n");
+
+    if(n == 0){
+        return;
+    }
+    str_gap_move(gap, pos);
+    str_gap_reserve(gap, n, args);
+    memcpy(gap->buf + gap->gap_start, cstr, n);
+    gap->gap_start += n;
+}
+
+void
+_str_gap_insert_cstr(StrGap *gap, size_t pos, const char *cstr, Args args)
+{
+    MUST(cstr != NULL, "cstr is NULL in str_gap_insert_cstr");
+    _str_gap_insert_n(gap, pos, cstr, _strlen(cstr), args);
+}
+
+void
+_str_gap_append_sv(StrGap *gap, StringView sv, Args args)
+{
+    MUST(gap != NULL, "gap is NULL in str_gap_append_sv");
+    _str_gap_insert_n(gap, str_gap_size(gap), sv.ptr, sv.len, args);
+}
+
+void
+str_gap_remove(StrGap *gap, size_t pos, size_t n)
+{
+    MUST(gap != NULL,                                 "gap is NULL in str_gap_remove");
+    MUST(pos <= str_gap_size(gap),                    "pos out of bounds in str_gap_remove");
+    MUST(n <= str_gap_size(gap) - pos,                "n out of bounds in str_gap_remove");
+
+    /* The removed bytes simply join the gap */
+    str_gap_move(gap, pos);
+    gap->gap_end += n;
+}
+
+size_t
+str_gap_size(const StrGap *gap)
+{
+    MUST(gap != NULL, "gap is NULL in str_gap_size");
+    return gap->capacity - (gap->gap_end - gap->gap_start);
+}
+
+char
+str_gap_at(const StrGap *gap, size_t index)
+{
+    MUST(gap != NULL,                  "gap is NULL in str_gap_at");
+    MUST(index < str_gap_size(gap),    "index is out of bound in str_gap_at");
+
+    if(index < gap->gap_start){
+        return gap->buf[index];
+    }
+    return gap->buf[index + (gap->gap_end - gap->gap_start)];
+}
+
+size_t
+str_gap_chunks(const StrGap *gap, StringView chunks[2])
+{
+    size_t count = 0;
+    MUST(gap != NULL,    "gap is NULL in str_gap_chunks");
+    MUST(chunks != NULL, "chunks is NULL in str_gap_chunks");
+
+    if(gap->gap_start > 0){
+        chunks[count++] = sv_from_parts(gap->buf, gap->gap_start);
+    }
+    if(gap->gap_end < gap->capacity){
+        chunks[count++] = sv_from_parts(gap->buf + gap->gap_end, gap->capacity - gap->gap_end);
+    }
+    return count;
+}
+
+void
+_str_gap_flatten(String *dest, const StrGap *gap, Args args)
+{
+    StringView chunks[2];
+    size_t count, i, at = 0;
+    MUST(dest != NULL, "dest is NULL in str_gap_flatten");
+    MUST(gap != NULL,  "gap is NULL in str_gap_flatten");
+
+    count = str_gap_chunks(gap, chunks);
+    str_resize(dest, str_gap_size(gap), args);
+    for(i = 0; i < count; ++i){
+        memcpy(str_data(dest) + at, chunks[i].ptr, chunks[i].len);
+        at += chunks[i].len;
+    }
+    str_data(dest)[dest->size] = '\0';
+}
+
+void
+str_gap_free(StrGap *gap)
+{
+    MUST(gap != NULL, "gap is NULL in str_gap_free");
+    free(gap->buf);
+
+    gap->buf = NULL;
+    gap->capacity = 0;
+    gap->gap_start = 0;
+    gap->gap_end = 0;
+}
@@ -25,38 +25,249 @@
 
 #define STR_INIT_CAPACITY 63
 #define STR_FMT   "%.*s"
-#define STR_ARG(str) (int)str.size, str.arr
+#define STR_ARG(str) (int)(str).size, str_data(&(str))
 
 #define STR_FOREACH(str, ch) \
-    for (size_t _i = 0; _i < (str).size && ((ch) = (str).arr[_i], 1); ++_i)
+    for (size_t _i = 0; _i < (str).size && ((ch) = str_data(&(str))[_i], 1); ++_i)
 
 
 typedef struct {
     Arena *arena;
+#ifdef ARENA_PROFILE
+    const char *tag; /* arena_profile tag, set by the str_* macros to their own name */
+#endif
 } Args;
 
+#ifdef ARENA_PROFILE
+#define STR_ARGS(name, ...) ((Args){.tag = name, __VA_ARGS__})
+#else
+#define STR_ARGS(name, ...) ((Args){__VA_ARGS__})
+#endif
+
+/*
+    Contents shorter than STR_SSO_CAPACITY live in buf.sso, inside the String,
+    and move to buf.heap (the heap or the arena) once they outgrow it. The
+    last sso byte tells them apart: 0 for inline strings, where it doubles as
+    the terminator of a full buffer, STR_HEAP for the others. A zeroed String
+    is an empty inline string. Read the contents through str_data, which
+    works the same for both. A String holds no pointer to itself, so it can
+    be copied by value or moved by arena_realloc: an inline copy owns its
+    bytes, a heap copy shares the buffer of the original.
+*/
+#define STR_SSO_CAPACITY 24
+#define STR_HEAP 1
+
 typedef struct {
-    char *arr;
+    union {
+        struct {
+            char *arr;
+            size_t capacity;
+        } heap;
+        char sso[STR_SSO_CAPACITY];
+    } buf;
     size_t size;
-    size_t capacity;
 } String;
 
+#define STR_TAG(str) ((str).buf.sso[STR_SSO_CAPACITY - 1])
+#define STR_IS_INLINE(str) (STR_TAG(str) == 0)
+#define STR_CAPACITY(str) (STR_IS_INLINE(str) ? (size_t)STR_SSO_CAPACITY : (str).buf.heap.capacity)
+
+static inline char *
+str_data(const String *string)
+{
+    return STR_IS_INLINE(*string) ? (char *)string->buf.sso : string->buf.heap.arr;
+}
+
+/*
+    Non-owning slice of bytes, usually of a String or a C string. Views never
+    allocate and are not NUL terminated; they are only valid while the bytes
+    they point to are alive and unchanged.
+*/
+typedef struct {
+    const char *ptr;
+    size_t len;
+} StringView;
+
+#define SV_FMT   "%.*s"
+#define SV_ARG(sv) (int)(sv).len, (sv).ptr
+
+/*
+    Needle preprocessed once for many searches. Needles up to
+    STR_SEARCH_SHORT_MAX bytes use a SIMD first/last byte filter; longer ones
+    use Two-Way, which is linear in the haystack whatever the needle, with a
+    bad character shift on the window's last two bytes so that most windows
+    are skipped without comparing. The searcher points to the needle, which must stay
+    alive and unchanged while it is used.
+*/
+#define STR_SEARCH_SHORT_MAX 32
+
+typedef struct {
+    const char *needle;
+    size_t size;
+    size_t critical;   /* Two-Way critical factorization needle[0, critical) needle[critical, size) */
+    size_t period;     /* shift after a full match of the right half */
+    int periodic;      /* the left half repeats with period, matched bytes are remembered */
+    size_t shift[256]; /* by pair hash, distance from the pair's last occurrence to the needle's end, long needles only */
+} StrSearcher;
+
+/*
+    Forward iteration over the non-overlapping matches of a searcher:
+        StrFindIter it;
+        size_t pos;
+        str_find_iter(&it, &string, &searcher);
+        while(str_find_next(&it, &pos)){ ... }
+    Each search resumes after the previous match, nothing is allocated. An
+    empty needle matches at every offset, the end included.
+*/
+typedef struct {
+    const StrSearcher *searcher;
+    const String *string;
+    size_t pos;  /* where the next search starts */
+    int done;
+} StrFindIter;
+
+/*
+    Zero-copy splitting. Fields are views into the split bytes, which must
+    outlive them:
+        StrSplitIter it;
+        StringView field;
+        str_split_init_byte(&it, sv_from_str(&line), ',', 0);
+        while(str_split_next(&it, &field)){ ... }
+    n delimiters give n + 1 fields, empty ones included, unless
+    STR_SPLIT_SKIP_EMPTY is set, which turns the splitter into a tokenizer
+    over runs of delimiters. Byte and set delimiters are found 64 bytes at a
+    time: one SSE2/AVX2 compare per delimiter byte (sets of up to
+    STR_SPLIT_SIMD_SET bytes, larger ones use a lookup table) gives a bitmask
+    of the block, and the following fields are taken from it without
+    scanning again. String delimiters use an embedded StrSearcher.
+*/
+#define STR_SPLIT_SKIP_EMPTY (1u << 0)
+#define STR_SPLIT_SIMD_SET   8
+#define STR_SPLIT_BLOCK      64
+
+enum { STR_SPLIT_BYTE, STR_SPLIT_SET, STR_SPLIT_STR };
+
+typedef struct {
+    const char *base;       /* the bytes being split */
+    size_t end;             /* their length */
+    size_t pos;             /* start of the next field */
+    size_t block;           /* offset of the block hits describes */
+    size_t next;            /* offset of the next block to scan */
+    uint64_t hits;          /* unconsumed delimiters of the block, bit i is base[block + i] */
+    int kind;
+    unsigned flags;
+    int done;
+    size_t set_size;
+    unsigned char set[256]; /* the delimiters of a small set, a lookup table for a large one */
+    StrSearcher searcher;   /* string delimiters only */
+} StrSplitIter;
+
+ARENA_ARR(StrViews, StringView);
+
+/*
+    str_from_file replaces the contents of a String with a file. Regular files
+    are read into a buffer presized with fstat, in reads as large as the file,
+    so a file costs one allocation of its own size in heap and arena mode.
+    str_file_map is the zero-copy alternative: the file mapped read-only, its
+    bytes as a view (not NUL terminated) valid until str_file_unmap.
+*/
+#define STR_FILE_CHUNK ((size_t)64 * 1024) /* first buffer when the size is unknown, e.g. pipes */
+
+typedef struct {
+    StringView view;
+    void *addr;
+    size_t length;
+} StrFileMap;
+
+/*
+    Buffered reader yielding one record at a time from a file descriptor:
+        StrReader reader;
+        StringView line;
+        str_reader_init(&reader, fd, 0);
+        while(str_reader_next(&reader, &line) > 0){ ... }
+        str_reader_free(&reader);
+    Records are views into the reader's buffer, without their delimiter, and
+    are only valid until the next call. The buffer only grows for a record
+    longer than itself, so memory stays flat however large the input is. A
+    last record without a delimiter is still returned. The reader does not
+    own fd.
+*/
+#define STR_READER_CAPACITY ((size_t)64 * 1024)
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t capacity;
+    size_t start;   /* first byte of the next record */
+    size_t scan;    /* buf[start, scan) holds no delimiter, searches resume at scan */
+    size_t end;     /* end of the bytes read so far */
+    int eof;
+    Arena *arena;   /* where buf comes from, NULL for the heap */
+} StrReader;
+
+/*
+    Gap buffer for text edited in the middle, e.g. a template expanded in
+    place. The text is buf[0, gap_start) followed by buf[gap_end, capacity);
+    an edit first moves the gap to its position, so edits that stay close to
+    each other cost O(1) amortized however long the text is, where
+    str_insert_cstr_at moves the whole tail every time. Like a String it
+    starts zeroed and takes .arena on the calls that allocate, the same arena
+    (or none) every time. str_gap_chunks exposes the two runs of text without
+    copying, str_gap_flatten copies them into a String.
+*/
+#define STR_GAP_INIT_CAPACITY 256
+
+typedef struct {
+    char *buf;
+    size_t capacity;
+    size_t gap_start;
+    size_t gap_end;
+} StrGap;
+
+/*
+    Aho-Corasick automaton over many patterns, built once into an arena. The
+    goto and failure links are folded into one flat table of states x byte
+    classes (bytes that occur in no pattern share class 0), so scanning costs
+    one table load per haystack byte. Entries hold the row offset of the next
+    state, with STR_MATCHER_OUTPUT set when at least one pattern ends there.
+*/
+#define STR_MATCHER_OUTPUT ((uint32_t)1 << 31)
+
+typedef struct {
+    size_t pattern; /* index into the patterns given to str_matcher_build */
+    size_t offset;  /* where the match starts in the scanned string */
+} StrMatch;
+
+typedef int (*StrMatchFn)(StrMatch match, void *ctx); /* returning non-zero stops the scan */
+
+typedef struct {
+    size_t patterns;
+    size_t states;
+    size_t classes;
+    unsigned char class_of[256];
+    uint32_t *table;    /* states * classes next rows, with STR_MATCHER_OUTPUT */
+    int32_t *out;       /* per state, last pattern ending there or -1 */
+    uint32_t *out_link; /* per state, nearest proper suffix state with an output, 0 if none */
+    int32_t *dup_next;  /* per pattern, next pattern with the same text or -1 */
+    size_t *lengths;    /* per pattern */
+} StrMatcher;
+
 
 void _str_insert_cstr_at(String *string, const char *cstr, size_t pos, Args args);
 #define str_insert_cstr_at(string, cstr, pos, ...) \
-    _str_insert_cstr_at(string, cstr, pos, (Args){__VA_ARGS__})
+    _str_insert_cstr_at(string, cstr, pos, STR_ARGS("str_insert_cstr_at", __VA_ARGS__))
 
 void _str_insert_cstr_n_at(String *string, const char *cstr, size_t n, size_t pos, Args args);
 #define str_insert_cstr_n_at(string, cstr, n, pos, ...) \
-    _str_insert_cstr_n_at(string, cstr, n, pos, (Args){__VA_ARGS__})
+    _str_insert_cstr_n_at(string, cstr, n, pos, STR_ARGS("str_insert_cstr_n_at", __VA_ARGS__))
 
 void _str_append_cstr(String *string, const char *cstr, Args args);
 #define str_append_cstr(string, cstr, ...) \
-    _str_append_cstr(string, cstr, (Args){__VA_ARGS__})
+    _str_append_cstr(string, cstr, STR_ARGS("str_append_cstr", __VA_ARGS__))
 
 void _str_append_cstr_n(String *string, const char *cstr, size_t n, Args args);
 #define str_append_cstr_n(string, cstr, n, ...) \
-    _str_append_cstr_n(string, cstr, n, (Args){__VA_ARGS__})
+    _str_append_cstr_n(string, cstr, n, STR_ARGS("str_append_cstr_n", __VA_ARGS__))
 
 void str_insert_at(String *string, size_t pos, String *src);
 void str_set_at(String *string, size_t index, const char ch);
@@ -64,22 +275,35 @@ void str_set_at(String *string, size_t index, const char ch);
 void _str_set(String *dest, const String *src, Args args);
 
 #define str_set(dest, src, ...) \
-    _str_set(dest, src, (Args){__VA_ARGS__})
+    _str_set(dest, src, STR_ARGS("str_set", __VA_ARGS__))
 
 void _str_set_cstr(String *dest, const char *src, Args args);
 #define str_set_cstr(dest, src, ...) \
-    _str_set_cstr(dest, src, (Args){__VA_ARGS__})
+    _str_set_cstr(dest, src, STR_ARGS("str_set_cstr", __VA_ARGS__))
 
 void _str_append(String *dest, const String *src, Args args);
 #define str_append(dest, src, ...) \
-    _str_append(dest, src, (Args){__VA_ARGS__})
+    _str_append(dest, src, STR_ARGS("str_append", __VA_ARGS__))
 
 void _str_substr(String *dest, const String *src, size_t pos, size_t length, Args args);
 #define str_substr(dest, src, pos, length, ...) \
-    _str_substr(dest, src, pos, length, (Args){__VA_ARGS__})
+    _str_substr(dest, src, pos, length, STR_ARGS("str_substr", __VA_ARGS__))
 
 int str_find_cstr(const String *string, const char *cstr);
 
+void str_searcher_init(StrSearcher *searcher, const char *needle, size_t size);
+int str_searcher_find(const StrSearcher *searcher, const String *string);
+
+void str_find_iter(StrFindIter *it, const String *string, const StrSearcher *searcher);
+int str_find_next(StrFindIter *it, size_t *offset); /* 0 once there are no more matches */
+size_t str_searcher_count(const StrSearcher *searcher, const String *string);
+size_t str_count(const String *string1, const String *string2);
+size_t str_count_cstr(const String *string, const char *cstr);
+
+/* Patterns are non-empty C strings, fn may be NULL to only count. Returns the number of matches reported */
+StrMatcher *str_matcher_build(Arena *arena, const char **patterns, size_t n);
+size_t str_matcher_scan(const StrMatcher *matcher, const String *string, StrMatchFn fn, void *ctx);
+
 int str_find(const String *string1, const String *string2);
 int str_find_ch(const String *string, const char ch);
 void str_reverse(const String *string);
@@ -94,15 +318,100 @@ void str_trim_left(String *string);
 void str_trim_right(String *string);
 void str_remove_cstr(String *string, const char *cstr);
 void str_remove(String *string1, const String *string2);
-/* 
-void str_replace(String *string1, const String *string2, Args args); 
-void str_replace_cstr(String *string, const char *cstr, Args args); 
-void str_clear(String *string); 
+/*
+    dest = src with needle replaced by replacement, the first match only or
+    all non-overlapping ones. Matches are counted first, then the result is
+    written once into a buffer of exactly size + 1 bytes. dest may be src.
+*/
+void _str_replace(String *dest, const String *src, const String *needle, const String *replacement, Args args);
+#define str_replace(dest, src, needle, replacement, ...) \
+    _str_replace(dest, src, needle, replacement, STR_ARGS("str_replace", __VA_ARGS__))
+
+void _str_replace_cstr(String *dest, const String *src, const char *needle, const char *replacement, Args args);
+#define str_replace_cstr(dest, src, needle, replacement, ...) \
+    _str_replace_cstr(dest, src, needle, replacement, STR_ARGS("str_replace_cstr", __VA_ARGS__))
+
+void _str_replace_all(String *dest, const String *src, const String *needle, const String *replacement, Args args);
+#define str_replace_all(dest, src, needle, replacement, ...) \
+    _str_replace_all(dest, src, needle, replacement, STR_ARGS("str_replace_all", __VA_ARGS__))
+
+void _str_replace_all_cstr(String *dest, const String *src, const char *needle, const char *replacement, Args args);
+#define str_replace_all_cstr(dest, src, needle, replacement, ...) \
+    _str_replace_all_cstr(dest, src, needle, replacement, STR_ARGS("str_replace_all_cstr", __VA_ARGS__))
+
+/*
+void str_clear(String *string);
 */
 void str_free(String *string);
 
+void str_split_init_byte(StrSplitIter *it, StringView sv, const char delim, unsigned flags);
+void str_split_init_set(StrSplitIter *it, StringView sv, const char *set, unsigned flags);
+void str_split_init_str(StrSplitIter *it, StringView sv, const char *delim, unsigned flags);
+int str_split_next(StrSplitIter *it, StringView *field);
+size_t str_split_collect(StrSplitIter *it, Arena *arena, StrViews *out); /* appends the rest, returns how many */
+size_t str_split(Arena *arena, StrViews *out, const String *string, const char delim);
+
+StringView sv_from_str(const String *string);
+StringView sv_from_cstr(const char *cstr);
+StringView sv_from_parts(const char *ptr, size_t len);
+StringView sv_substr(StringView sv, size_t pos, size_t length); /* clamped to the view like str_substr */
+StringView sv_trim(StringView sv);       /* spaces, like str_trim */
+StringView sv_trim_left(StringView sv);
+StringView sv_trim_right(StringView sv);
+int sv_find(StringView sv, StringView needle);
+int sv_find_cstr(StringView sv, const char *cstr);
+int sv_find_ch(StringView sv, const char ch);
+int sv_compare(StringView sv1, StringView sv2);
+int sv_icompare(StringView sv1, StringView sv2);
+int sv_equal(StringView sv1, StringView sv2);
+int sv_starts_with(StringView sv, StringView prefix);
+int sv_ends_with(StringView sv, StringView suffix);
+
+/* Copies the view into a String, the view may point into dest itself */
+void _str_set_sv(String *dest, StringView sv, Args args);
+#define str_set_sv(dest, sv, ...) \
+    _str_set_sv(dest, sv, STR_ARGS("str_set_sv", __VA_ARGS__))
+
+void _str_append_sv(String *dest, StringView sv, Args args);
+#define str_append_sv(dest, sv, ...) \
+    _str_append_sv(dest, sv, STR_ARGS("str_append_sv", __VA_ARGS__))
+
 int _str_from_file(String *string, const char *filename, Args args);
 #define str_from_file(string, filename, ...) \
-    _str_from_file(string, filename, (Args){__VA_ARGS__})
+    _str_from_file(string, filename, STR_ARGS("str_from_file", __VA_ARGS__))
+
+int str_file_map(StrFileMap *map, const char *filename);
+void str_file_unmap(StrFileMap *map);
+
+void _str_reader_init(StrReader *reader, int fd, size_t capacity, Args args); /* capacity 0 is STR_READER_CAPACITY */
+#define str_reader_init(reader, fd, capacity, ...) \
+    _str_reader_init(reader, fd, capacity, STR_ARGS("str_reader_init", __VA_ARGS__))
+
+int str_reader_next(StrReader *reader, StringView *line); /* 1 with a record, 0 at the end, -1 on read errors */
+int str_reader_next_delim(StrReader *reader, const char delim, StringView *record);
+void str_reader_free(StrReader *reader);
+
+void _str_gap_insert_n(StrGap *gap, size_t pos, const char *cstr, size_t n, Args args);
+#define str_gap_insert_n(gap, pos, cstr, n, ...) \
+    _str_gap_insert_n(gap, pos, cstr, n, STR_ARGS("str_gap_insert_n", __VA_ARGS__))
+
+void _str_gap_insert_cstr(StrGap *gap, size_t pos, const char *cstr, Args args);
+#define str_gap_insert_cstr(gap, pos, cstr, ...) \
+    _str_gap_insert_cstr(gap, pos, cstr, STR_ARGS("str_gap_insert_cstr", __VA_ARGS__))
+
+void _str_gap_append_sv(StrGap *gap, StringView sv, Args args);
+#define str_gap_append_sv(gap, sv, ...) \
+    _str_gap_append_sv(gap, sv, STR_ARGS("str_gap_append_sv", __VA_ARGS__))
+
+void str_gap_remove(StrGap *gap, size_t pos, size_t n);
+size_t str_gap_size(const StrGap *gap);
+char str_gap_at(const StrGap *gap, size_t index);
+size_t str_gap_chunks(const StrGap *gap, StringView chunks[2]); /* the non-empty runs in order, returns how many */
+
+void _str_gap_flatten(String *dest, const StrGap *gap, Args args);
+#define str_gap_flatten(dest, gap, ...) \
+    _str_gap_flatten(dest, gap, STR_ARGS("str_gap_flatten", __VA_ARGS__))
+
+void str_gap_free(StrGap *gap); /* heap gap buffers only, like str_free */
 
 #endif